@@ -7,6 +7,7 @@ const gnumakebuild = @import("gnumakebuild.zig");
 
 pub fn build(b: *std.build.Builder) void {
     const trace_enabled = b.option(bool, "trace", "enable libc tracing") orelse false;
+    const malloc_backend = b.option(libcbuild.Malloc, "malloc", "the allocator behind malloc (default: fast)") orelse .fast;
 
     {
         const exe = b.addExecutable(.{
@@ -29,6 +30,7 @@ pub fn build(b: *std.build.Builder) void {
         .link = .static,
         .start = .ziglibc,
         .trace = trace_enabled,
+        .malloc = malloc_backend,
         .target = target,
         .optimize = optimize,
     });
@@ -38,6 +40,7 @@ pub fn build(b: *std.build.Builder) void {
         .link = .shared,
         .start = .ziglibc,
         .trace = trace_enabled,
+        .malloc = malloc_backend,
         .target = target,
         .optimize = optimize,
     });
@@ -50,6 +53,7 @@ pub fn build(b: *std.build.Builder) void {
         .link = .static,
         .start = .ziglibc,
         .trace = trace_enabled,
+        .malloc = malloc_backend,
         .target = target,
         .optimize = optimize,
     });
@@ -59,6 +63,7 @@ pub fn build(b: *std.build.Builder) void {
         .link = .shared,
         .start = .ziglibc,
         .trace = trace_enabled,
+        .malloc = malloc_backend,
         .target = target,
         .optimize = optimize,
     });
@@ -69,6 +74,7 @@ pub fn build(b: *std.build.Builder) void {
         .link = .static,
         .start = .ziglibc,
         .trace = trace_enabled,
+        .malloc = malloc_backend,
         .target = target,
         .optimize = optimize,
     });
@@ -79,6 +85,7 @@ pub fn build(b: *std.build.Builder) void {
         .link = .static,
         .start = .ziglibc,
         .trace = trace_enabled,
+        .malloc = malloc_backend,
         .target = target,
         .optimize = optimize,
     });
@@ -89,6 +96,7 @@ pub fn build(b: *std.build.Builder) void {
         .link = .static,
         .start = .ziglibc,
         .trace = trace_enabled,
+        .malloc = malloc_backend,
         .target = target,
         .optimize = optimize,
     });
@@ -122,6 +130,14 @@ pub fn build(b: *std.build.Builder) void {
         run_step.addCheck(.{ .expect_stdout_exact = "Success!\n" });
         test_step.dependOn(&run_step.step);
     }
+    {
+        const exe = addTest("stdio", b, target, optimize, libc_only_std_static, zig_start);
+        addPosix(exe, libc_only_posix);
+        const run_step = b.addRunArtifact(test_env_exe);
+        run_step.addArtifactArg(exe);
+        run_step.addCheck(.{ .expect_stdout_exact = "Success!\n" });
+        test_step.dependOn(&run_step.step);
+    }
     {
         const exe = addTest("format", b, target, optimize, libc_only_std_static, zig_start);
         const run_step = b.addRunArtifact(test_env_exe);
@@ -148,6 +164,63 @@ pub fn build(b: *std.build.Builder) void {
         run_step.addCheck(.{ .expect_stdout_exact = "Success!\n" });
         test_step.dependOn(&run_step.step);
     }
+    {
+        const exe = addTest("malloc", b, target, optimize, libc_only_std_static, zig_start);
+        exe.addIncludePath(.{ .path = "inc" ++ std.fs.path.sep_str ++ "linux" });
+        addPosix(exe, libc_only_posix);
+        const run_step = b.addRunArtifact(exe);
+        run_step.addArg(@tagName(malloc_backend));
+        run_step.addCheck(.{ .expect_stdout_exact = "Success!\n" });
+        test_step.dependOn(&run_step.step);
+        // again with the heap profiler sampling often and huge pages
+        const profile_step = b.addRunArtifact(exe);
+        profile_step.addArg(@tagName(malloc_backend));
+        profile_step.setEnvironmentVariable("ZIGLIBC_MALLOC_HUGEPAGES", "1");
+        profile_step.setEnvironmentVariable(
+            "ZIGLIBC_HEAP_PROFILE",
+            b.pathJoin(&.{ b.cache_root.path orelse ".", "malloc.heapprof" }),
+        );
+        profile_step.setEnvironmentVariable("ZIGLIBC_HEAP_PROFILE_RATE", "4096");
+        profile_step.addCheck(.{ .expect_stdout_exact = "Success!\n" });
+        test_step.dependOn(&profile_step.step);
+    }
+    // the other allocator backends run every test that allocates
+    for (std.enums.values(libcbuild.Malloc)) |other_backend| {
+        if (other_backend == malloc_backend) continue;
+        const libc = libcbuild.addLibc(b, .{
+            .variant = .only_std,
+            .link = .static,
+            .start = .ziglibc,
+            .trace = trace_enabled,
+            .malloc = other_backend,
+            .target = target,
+            .optimize = optimize,
+        });
+        inline for (.{ "strings", "fs", "stdio", "format", "scanf", "strto" }) |name| {
+            // testenv runs each program in a directory named after it
+            const exe = addNamedTest(name, b.fmt("{s}-{s}", .{ name, @tagName(other_backend) }), b, target, optimize, libc, zig_start);
+            addPosix(exe, libc_only_posix);
+            const run_step = b.addRunArtifact(test_env_exe);
+            run_step.addArtifactArg(exe);
+            run_step.addCheck(.{ .expect_stdout_exact = "Success!\n" });
+            test_step.dependOn(&run_step.step);
+        }
+        const exe = addTest("malloc", b, target, optimize, libc, zig_start);
+        exe.addIncludePath(.{ .path = "inc" ++ std.fs.path.sep_str ++ "linux" });
+        addPosix(exe, libc_only_posix);
+        const run_step = b.addRunArtifact(exe);
+        run_step.addArg(@tagName(other_backend));
+        run_step.addCheck(.{ .expect_stdout_exact = "Success!\n" });
+        test_step.dependOn(&run_step.step);
+    }
+    {
+        const exe = addTest("obstack", b, target, optimize, libc_only_std_static, zig_start);
+        exe.addIncludePath(.{ .path = "inc" ++ std.fs.path.sep_str ++ "gnu" });
+        exe.linkLibrary(libc_only_gnu);
+        const run_step = b.addRunArtifact(exe);
+        run_step.addCheck(.{ .expect_stdout_exact = "Success!\n" });
+        test_step.dependOn(&run_step.step);
+    }
     {
         const exe = addTest("getopt", b, target, optimize, libc_only_std_static, zig_start);
         addPosix(exe, libc_only_posix);
@@ -211,9 +284,22 @@ fn addTest(
     optimize: anytype,
     libc_only_std_static: *std.build.LibExeObjStep,
     zig_start: *std.build.LibExeObjStep,
+) *std.build.LibExeObjStep {
+    return addNamedTest(name, name, b, target, optimize, libc_only_std_static, zig_start);
+}
+
+/// addTest with an executable name that differs from the test's source file
+fn addNamedTest(
+    comptime name: []const u8,
+    exe_name: []const u8,
+    b: *std.build.Builder,
+    target: anytype,
+    optimize: anytype,
+    libc_only_std_static: *std.build.LibExeObjStep,
+    zig_start: *std.build.LibExeObjStep,
 ) *std.build.LibExeObjStep {
     const exe = b.addExecutable(.{
-        .name = name,
+        .name = exe_name,
         .root_source_file = .{ .path = "test" ++ std.fs.path.sep_str ++ name ++ ".c" },
         .target = target,
         .optimize = optimize,
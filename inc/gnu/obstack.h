@@ -0,0 +1,139 @@
+#ifndef _OBSTACK_H
+#define _OBSTACK_H
+
+#include "../libc/private/size_t.h"
+
+/* Like the GNU version, the program has to define obstack_chunk_alloc and
+   obstack_chunk_free (usually as malloc and free) before using obstack_init. */
+
+struct _obstack_chunk {
+  char *limit;
+  struct _obstack_chunk *prev;
+  /* the contents follow the header */
+};
+
+struct obstack {
+  size_t chunk_size;
+  struct _obstack_chunk *chunk;
+  char *object_base;
+  char *next_free;
+  char *chunk_limit;
+  size_t alignment_mask;
+  void *(*chunkfun)(size_t);
+  void (*freefun)(void *);
+  /* set when an empty object may have been finished at the start of a chunk */
+  unsigned char maybe_empty_object;
+};
+
+extern void (*obstack_alloc_failed_handler)(void);
+
+int _obstack_begin(struct obstack *h, size_t size, size_t alignment,
+                   void *(*chunkfun)(size_t), void (*freefun)(void *));
+void _obstack_newchunk(struct obstack *h, size_t length);
+int _obstack_allocated_p(struct obstack *h, void *obj);
+size_t _obstack_memory_used(struct obstack *h);
+/* Frees obj and everything allocated after it.  If obj is NULL every chunk
+   is freed and the obstack has to be initialized again before it's used. */
+void obstack_free(struct obstack *h, void *obj);
+
+#define obstack_init(h) \
+  _obstack_begin((h), 0, 0, (void *(*)(size_t))obstack_chunk_alloc, (void (*)(void *))obstack_chunk_free)
+#define obstack_begin(h, size) \
+  _obstack_begin((h), (size), 0, (void *(*)(size_t))obstack_chunk_alloc, (void (*)(void *))obstack_chunk_free)
+#define obstack_specify_allocation(h, size, alignment, chunkfun, freefun) \
+  _obstack_begin((h), (size), (alignment), (void *(*)(size_t))(chunkfun), (void (*)(void *))(freefun))
+#define obstack_chunkfun(h, newchunkfun) ((h)->chunkfun = (void *(*)(size_t))(newchunkfun))
+#define obstack_freefun(h, newfreefun) ((h)->freefun = (void (*)(void *))(newfreefun))
+
+#define obstack_base(h) ((void *)(h)->object_base)
+#define obstack_next_free(h) ((void *)(h)->next_free)
+#define obstack_chunk_size(h) ((h)->chunk_size)
+#define obstack_alignment_mask(h) ((h)->alignment_mask)
+#define obstack_memory_used(h) _obstack_memory_used(h)
+#define obstack_object_size(h) ((size_t)((h)->next_free - (h)->object_base))
+#define obstack_room(h) ((size_t)((h)->chunk_limit - (h)->next_free))
+
+#define obstack_1grow_fast(h, datum) ((void)(*((h)->next_free)++ = (datum)))
+#define obstack_blank_fast(h, n) ((void)((h)->next_free += (n)))
+#define obstack_ptr_grow_fast(h, aptr) __extension__ ({ \
+  struct obstack *__o1 = (h); \
+  const void *__p1 = (aptr); \
+  __builtin_memcpy(__o1->next_free, &__p1, sizeof(__p1)); \
+  __o1->next_free += sizeof(__p1); \
+  (void)0; })
+#define obstack_int_grow_fast(h, aint) __extension__ ({ \
+  struct obstack *__o1 = (h); \
+  int __i1 = (aint); \
+  __builtin_memcpy(__o1->next_free, &__i1, sizeof(__i1)); \
+  __o1->next_free += sizeof(__i1); \
+  (void)0; })
+
+#define obstack_make_room(h, length) __extension__ ({ \
+  struct obstack *__o = (h); \
+  size_t __len = (length); \
+  if (obstack_room(__o) < __len) _obstack_newchunk(__o, __len); \
+  (void)0; })
+
+#define obstack_grow(h, where, length) __extension__ ({ \
+  struct obstack *__o = (h); \
+  size_t __len = (length); \
+  if (obstack_room(__o) < __len) _obstack_newchunk(__o, __len); \
+  __builtin_memcpy(__o->next_free, (where), __len); \
+  __o->next_free += __len; \
+  (void)0; })
+
+#define obstack_grow0(h, where, length) __extension__ ({ \
+  struct obstack *__o = (h); \
+  size_t __len = (length); \
+  if (obstack_room(__o) < __len + 1) _obstack_newchunk(__o, __len + 1); \
+  __builtin_memcpy(__o->next_free, (where), __len); \
+  __o->next_free += __len; \
+  *(__o->next_free)++ = 0; \
+  (void)0; })
+
+#define obstack_1grow(h, datum) __extension__ ({ \
+  struct obstack *__o = (h); \
+  if (obstack_room(__o) < 1) _obstack_newchunk(__o, 1); \
+  obstack_1grow_fast(__o, datum); })
+
+#define obstack_ptr_grow(h, datum) __extension__ ({ \
+  struct obstack *__o = (h); \
+  if (obstack_room(__o) < sizeof(void *)) _obstack_newchunk(__o, sizeof(void *)); \
+  obstack_ptr_grow_fast(__o, datum); })
+
+#define obstack_int_grow(h, datum) __extension__ ({ \
+  struct obstack *__o = (h); \
+  if (obstack_room(__o) < sizeof(int)) _obstack_newchunk(__o, sizeof(int)); \
+  obstack_int_grow_fast(__o, datum); })
+
+#define obstack_blank(h, length) __extension__ ({ \
+  struct obstack *__o = (h); \
+  size_t __len = (length); \
+  if (obstack_room(__o) < __len) _obstack_newchunk(__o, __len); \
+  obstack_blank_fast(__o, __len); })
+
+#define obstack_finish(h) __extension__ ({ \
+  struct obstack *__o1 = (h); \
+  void *__value = (void *)__o1->object_base; \
+  if (__o1->next_free == __value) __o1->maybe_empty_object = 1; \
+  __o1->next_free = (char *)(((size_t)__o1->next_free + __o1->alignment_mask) & ~__o1->alignment_mask); \
+  if (__o1->next_free > __o1->chunk_limit) __o1->next_free = __o1->chunk_limit; \
+  __o1->object_base = __o1->next_free; \
+  __value; })
+
+#define obstack_alloc(h, length) __extension__ ({ \
+  struct obstack *__h = (h); \
+  obstack_blank(__h, (length)); \
+  obstack_finish(__h); })
+
+#define obstack_copy(h, where, length) __extension__ ({ \
+  struct obstack *__h = (h); \
+  obstack_grow(__h, (where), (length)); \
+  obstack_finish(__h); })
+
+#define obstack_copy0(h, where, length) __extension__ ({ \
+  struct obstack *__h = (h); \
+  obstack_grow0(__h, (where), (length)); \
+  obstack_finish(__h); })
+
+#endif /* _OBSTACK_H */
@@ -14,15 +14,18 @@ extern int errno;
     #define EPERM 1
     #define ENOENT 2
     #define EINTR 4
+    #define EBADF 9
     #define EAGAIN 11
     #define ENOMEM 12
     #define EACCES 13
     #define EEXIST 17
     #define EINVAL 22
     #define ENOTTY 25
+    #define ENOSPC 28
     #define EPIPE 32
     #define EDOM 33
     #define ERANGE 34
+    #define EOVERFLOW 75
     #define EWOULDBLOCK 140
     #define ECONNREFUSED 111
 #endif
@@ -4,11 +4,13 @@
 #include "private/null.h"
 #include "private/size_t.h"
 #include "private/valist.h"
+#include "private/wchar_t.h"
+#include "../posix/private/ssize_t.h"
 
 #define _IOFBF 0
 #define _IOLBF 1
 #define _IONBF 2
-#define BUFSIZ 1024
+#define BUFSIZ 8192
 
 #define SEEK_SET 0
 #define SEEK_CUR 1
@@ -22,9 +24,30 @@ typedef struct {
 #endif
   int errno;
   int eof;
+  /* the rest is private to the libc */
+  int flags;
+  int buf_mode;
+  unsigned char *buf;
+  size_t buf_size;
+  /* output bytes waiting at the start of buf */
+  size_t buf_len;
+  /* input that hasn't been read yet, rpos == rend when there is none */
+  unsigned char *rpos;
+  unsigned char *rend;
+  /* where the input starts, buf or the file's memory when it's mapped */
+  unsigned char *rbase;
+  /* offset of the underlying file, when the libc knows it */
+  long long offset;
+  /* recursive lock, see flockfile */
+  unsigned int lock;
+  unsigned int lock_count;
+  void *lock_owner;
+  /* how the stream does I/O and its state, NULL for a file descriptor */
+  const void *ops;
+  void *cookie;
 } FILE;
 
-typedef size_t fpos_t;
+typedef long long fpos_t;
 
 /* a pointer to a single object T that cannot be null */
 #define SINGLE_OBJECT_PTR(T, name) T name[static 1]
@@ -92,6 +115,29 @@ void perror(const char *s);
     FILE *popen(const char *command, const char *mode);
     FILE *fdopen(int filedes, const char *mode);
     int fileno(FILE *stream);
+    ssize_t getdelim(char **lineptr, size_t *n, int delim, FILE *stream);
+    ssize_t getline(char **lineptr, size_t *n, FILE *stream);
+    FILE *fmemopen(void *buf, size_t size, const char *mode);
+    FILE *open_memstream(char **bufp, size_t *sizep);
+    FILE *open_wmemstream(wchar_t **bufp, size_t *sizep);
+    void flockfile(FILE *stream);
+    int ftrylockfile(FILE *stream);
+    void funlockfile(FILE *stream);
+    int getc_unlocked(FILE *stream);
+    int getchar_unlocked(void);
+    int putc_unlocked(int c, FILE *stream);
+    int putchar_unlocked(int c);
+#endif
+
+// NOTE: these are GNU extensions, not libc or POSIX
+#if 1
+    int fgetc_unlocked(FILE *stream);
+    int fputc_unlocked(int c, FILE *stream);
+    char *fgets_unlocked(char *s, int n, FILE *stream);
+    int fputs_unlocked(const char *s, FILE *stream);
+    size_t fread_unlocked(void *ptr, size_t size, size_t nmemb, FILE *stream);
+    size_t fwrite_unlocked(const void *ptr, size_t size, size_t nmemb, FILE *stream);
+    int fflush_unlocked(FILE *stream);
 #endif
 
 // NOTE: this stuff is defined by linux, not libc, but they need
@@ -25,6 +25,7 @@ void *calloc(size_t nmemb, size_t size);
 void free(void *ptr);
 void *malloc(size_t size);
 void *realloc(void *ptr, size_t size);
+void *aligned_alloc(size_t alignment, size_t size);
 void abort(void);
 int atexit(void (*func)(void));
 void exit(int status);
@@ -46,6 +47,7 @@ size_t wcstombs(char *s, const wchar_t *pwcs, size_t n);
 //       to live in this header
 #if 1
     int mkstemp(char *template);
+    int posix_memalign(void **memptr, size_t alignment, size_t size);
 #endif
 
 // NOTE: this stuff is defined by linux, not libc, but they need
@@ -46,5 +46,17 @@ char *strdup(const char *s);
     size_t strlcat(char *dst, const char *src, size_t size);
 #endif
 
+// NOTE: memmem, memrchr, rawmemchr and strcasestr are GNU extensions (memmem
+//       is also in POSIX 2024), glibc declares them here when _GNU_SOURCE is
+//       defined.
+void *memmem(const void *haystack, size_t haystacklen, const void *needle, size_t needlelen);
+void *memrchr(const void *s, int c, size_t n);
+void *rawmemchr(const void *s, int c);
+char *strcasestr(const char *haystack, const char *needle);
+
+// NOTE: strtok_r is POSIX and strsep comes from BSD, glibc declares both here.
+char *strtok_r(char *s, const char *delim, char **saveptr);
+char *strsep(char **stringp, const char *delim);
+
 
 #endif /* _STRING_H */
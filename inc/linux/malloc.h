@@ -0,0 +1,32 @@
+#ifndef _MALLOC_H
+#define _MALLOC_H
+
+#include "../libc/private/size_t.h"
+
+void *malloc(size_t size);
+void *calloc(size_t nmemb, size_t size);
+void *realloc(void *ptr, size_t size);
+void free(void *ptr);
+void *memalign(size_t alignment, size_t size);
+void *valloc(size_t size);
+void *pvalloc(size_t size);
+
+struct mallinfo2 {
+  size_t arena;    /* bytes mapped for size class pages */
+  size_t ordblks;  /* free blocks in size class pages */
+  size_t smblks;   /* unused */
+  size_t hblks;    /* blocks with their own mapping */
+  size_t hblkhd;   /* bytes mapped for those blocks */
+  size_t usmblks;  /* unused */
+  size_t fsmblks;  /* unused */
+  size_t uordblks; /* bytes in use in size class pages */
+  size_t fordblks; /* bytes mapped but not in use in size class pages */
+  size_t keepcost; /* bytes malloc_trim can release right away */
+};
+
+struct mallinfo2 mallinfo2(void);
+void malloc_stats(void);
+int malloc_trim(size_t pad);
+size_t malloc_usable_size(void *ptr);
+
+#endif /* _MALLOC_H */
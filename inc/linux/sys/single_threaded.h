@@ -0,0 +1,9 @@
+#ifndef _SYS_SINGLE_THREADED_H
+#define _SYS_SINGLE_THREADED_H
+
+/* Nonzero until the process starts a second thread with pthread_create,
+   programs may skip their own synchronization while it's set.  Read only,
+   like glibc's. */
+extern char __libc_single_threaded;
+
+#endif /* _SYS_SINGLE_THREADED_H */
@@ -39,7 +39,11 @@ typedef int pthread_once_t;
 typedef int pthread_rwlock_t;
 typedef int pthread_rwlockattr_t;
 typedef int pthread_spinlock_t;
-typedef int pthread_t;
+typedef unsigned long pthread_t;
+
+int pthread_create(pthread_t *restrict thread, const pthread_attr_t *restrict attr,
+                   void *(*start_routine)(void *), void *restrict arg);
+int pthread_join(pthread_t thread, void **retval);
 
 #define PTHREAD_MUTEX_INITIALIZER {0}
 int pthread_mutex_init(pthread_mutex_t *restrict, const pthread_mutexattr_t *restrict);
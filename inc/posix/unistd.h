@@ -10,6 +10,8 @@
 #define R_OK 4
 int access(const char *path, int amode);
 int close(int filedes);
+int dup(int fildes);
+int dup2(int fildes, int fildes2);
 
 ssize_t read(int filedes, void *buf, size_t nbyte);
 ssize_t write(int fildes, const void *buf, size_t nbyte);
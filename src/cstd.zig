@@ -15,6 +15,10 @@ const c = @cImport({
 });
 
 const trace = @import("trace.zig");
+const malloc_impl = @import("malloc.zig");
+const heapprof = @import("heapprof.zig");
+const simd = @import("simd.zig");
+const strsearch = @import("strsearch.zig");
 
 // __main appears to be a design inherited by LLVM from gcc.
 // it's typically provided by libgcc and is used to call constructors
@@ -29,6 +33,16 @@ comptime {
     if (builtin.os.tag == .windows) @export(__main, .{ .name = "__main" });
 }
 
+// called by the start code before main
+export fn __zinit() callconv(.C) void {
+    simd.init();
+}
+
+// called by pthread_create's thread function (posix.zig) before the thread exits
+export fn __zthreadExit() callconv(.C) void {
+    malloc_impl.threadExit();
+}
+
 const windows = struct {
     const HANDLE = std.os.windows.HANDLE;
 
@@ -56,6 +70,7 @@ const windows = struct {
         dwFlagsAndAttributes: u32,
         hTemplateFile: ?HANDLE,
     ) callconv(@import("std").os.windows.WINAPI) ?HANDLE;
+    pub const FILE_APPEND_DATA = 0x0004;
 };
 
 // --------------------------------------------------------------------------------
@@ -80,6 +95,8 @@ export fn exit(status: c_int) callconv(.C) noreturn {
             global.atexit_funcs.items[i - 1]();
         }
     }
+    _ = flushAll();
+    heapprof.dump();
     std.os.exit(@intCast(status));
 }
 
@@ -96,7 +113,7 @@ export fn atexit(func: ExitFunc) c_int {
         c.errno = c.EPERM;
         return -1;
     }
-    global.atexit_funcs.append(global.gpa.allocator(), func) catch |e| switch (e) {
+    global.atexit_funcs.append(malloc_impl.allocator, func) catch |e| switch (e) {
         error.OutOfMemory => {
             c.errno = c.ENOMEM;
             return -1;
@@ -130,87 +147,181 @@ export fn system(string: ?[*:0]const u8) callconv(.C) c_int {
     }
 }
 
-/// alloc_align is the maximum alignment needed for all types
-/// since malloc is not type aware, it just aligns every allocation
-/// to accomodate the maximum possible alignment that could be needed.
-///
-/// TODO: this should probably be in the zig std library somewhere.
-const alloc_align = 16;
-
-const alloc_metadata_len = std.mem.alignForward(usize, alloc_align, @sizeOf(usize));
+const alloc_align = malloc_impl.alloc_align;
 
 pub export fn malloc(size: usize) callconv(.C) ?[*]align(alloc_align) u8 {
     trace.log("malloc {}", .{size});
-    std.debug.assert(size > 0); // TODO: what should we do in this case?
-    const full_len = alloc_metadata_len + size;
-    const buf = global.gpa.allocator().alignedAlloc(u8, alloc_align, full_len) catch |err| switch (err) {
-        error.OutOfMemory => {
-            trace.log("malloc return null", .{});
-            return null;
-        },
+    heapprof.onAlloc(size, @returnAddress());
+    const result = malloc_impl.alloc(size) orelse {
+        trace.log("malloc return null", .{});
+        errno = c.ENOMEM;
+        return null;
     };
-    @as(*usize, @ptrCast(buf)).* = full_len;
-    const result = @as([*]align(alloc_align) u8, @ptrFromInt(@intFromPtr(buf.ptr) + alloc_metadata_len));
     trace.log("malloc return {*}", .{result});
     return result;
 }
 
-fn getGpaBuf(ptr: [*]u8) []align(alloc_align) u8 {
-    const start = @intFromPtr(ptr) - alloc_metadata_len;
-    const len = @as(*usize, @ptrFromInt(start)).*;
-    return @alignCast(@as([*]u8, @ptrFromInt(start))[0..len]);
-}
-
 export fn realloc(ptr: ?[*]align(alloc_align) u8, size: usize) callconv(.C) ?[*]align(alloc_align) u8 {
     trace.log("realloc {*} {}", .{ ptr, size });
-    const gpa_buf = getGpaBuf(ptr orelse {
+    const p = ptr orelse {
         const result = malloc(size);
         trace.log("realloc return {*} (from malloc)", .{result});
         return result;
-    });
+    };
     if (size == 0) {
-        global.gpa.allocator().free(gpa_buf);
+        malloc_impl.free(p);
         return null;
     }
-
-    const gpa_size = alloc_metadata_len + size;
-    if (global.gpa.allocator().rawResize(gpa_buf, std.math.log2(alloc_align), gpa_size, @returnAddress())) {
-        @as(*usize, @ptrCast(gpa_buf.ptr)).* = gpa_size;
-        trace.log("realloc return {*}", .{ptr});
-        return ptr;
-    }
-
-    const new_buf = global.gpa.allocator().reallocAdvanced(
-        gpa_buf,
-        gpa_size,
-        @returnAddress(),
-    ) catch |e| switch (e) {
-        error.OutOfMemory => {
-            trace.log("realloc out-of-mem from {} to {}", .{ gpa_buf.len, gpa_size });
-            return null;
-        },
+    heapprof.onAlloc(size, @returnAddress());
+    const result = malloc_impl.realloc(p, size) orelse {
+        trace.log("realloc out-of-mem from {} to {}", .{ malloc_impl.usableSize(p), size });
+        errno = c.ENOMEM;
+        return null;
     };
-    @as(*usize, @ptrCast(new_buf.ptr)).* = gpa_size;
-    const result = @as([*]align(alloc_align) u8, @ptrFromInt(@intFromPtr(new_buf.ptr) + alloc_metadata_len));
     trace.log("realloc return {*}", .{result});
     return result;
 }
 
 export fn calloc(nmemb: usize, size: usize) callconv(.C) ?[*]align(alloc_align) u8 {
+    trace.log("calloc {} {}", .{ nmemb, size });
     const total = std.math.mul(usize, nmemb, size) catch {
-        // TODO: set errno
-        //errno = c.ENOMEM;
+        errno = c.ENOMEM;
+        return null;
+    };
+    heapprof.onAlloc(total, @returnAddress());
+    const result = malloc_impl.allocZeroed(total) orelse {
+        trace.log("calloc return null", .{});
+        errno = c.ENOMEM;
+        return null;
+    };
+    trace.log("calloc return {*}", .{result});
+    return result;
+}
+
+export fn aligned_alloc(alignment: usize, size: usize) callconv(.C) ?[*]align(alloc_align) u8 {
+    trace.log("aligned_alloc {} {}", .{ alignment, size });
+    if (@popCount(alignment) != 1) {
+        errno = c.EINVAL;
+        return null;
+    }
+    return mallocAligned(alignment, size, @returnAddress());
+}
+
+fn mallocAligned(alignment: usize, size: usize, return_address: usize) ?[*]align(alloc_align) u8 {
+    heapprof.onAlloc(size, return_address);
+    const result = malloc_impl.allocAligned(size, alignment) orelse {
+        errno = c.ENOMEM;
         return null;
     };
-    const ptr = malloc(total) orelse return null;
-    @memset(ptr[0..total], 0);
-    return ptr;
+    trace.log("aligned alloc return {*}", .{result});
+    return result;
+}
+
+// NOTE: this is defined by POSIX, not libc
+export fn posix_memalign(memptr: *?*anyopaque, alignment: usize, size: usize) callconv(.C) c_int {
+    trace.log("posix_memalign {} {}", .{ alignment, size });
+    if (@popCount(alignment) != 1 or alignment % @sizeOf(*anyopaque) != 0) return c.EINVAL;
+    heapprof.onAlloc(size, @returnAddress());
+    memptr.* = @ptrCast(malloc_impl.allocAligned(size, alignment) orelse return c.ENOMEM);
+    return 0;
 }
 
 pub export fn free(ptr: ?[*]align(alloc_align) u8) callconv(.C) void {
     trace.log("free {*}", .{ptr});
-    const p = ptr orelse return;
-    global.gpa.allocator().free(getGpaBuf(p));
+    malloc_impl.free(ptr orelse return);
+}
+
+// NOTE: these are GNU extensions declared in inc/linux/malloc.h, they live
+//       here because they have to be in the same library as malloc
+const struct_mallinfo2 = extern struct {
+    arena: usize,
+    ordblks: usize,
+    smblks: usize,
+    hblks: usize,
+    hblkhd: usize,
+    usmblks: usize,
+    fsmblks: usize,
+    uordblks: usize,
+    fordblks: usize,
+    keepcost: usize,
+};
+
+export fn mallinfo2() callconv(.C) struct_mallinfo2 {
+    const info = malloc_impl.stats();
+    return .{
+        .arena = info.segment_bytes,
+        .ordblks = info.freeBlocks(),
+        .smblks = 0,
+        .hblks = info.huge_count,
+        .hblkhd = info.huge_bytes,
+        .usmblks = 0,
+        .fsmblks = 0,
+        .uordblks = info.in_use,
+        .fordblks = info.segment_bytes -| info.in_use,
+        .keepcost = info.cached_bytes,
+    };
+}
+
+export fn malloc_stats() callconv(.C) void {
+    const info = malloc_impl.stats();
+    lockStream(stderr);
+    defer unlockStream(stderr);
+    const writer = FileWriter{ .context = stderr };
+    writer.print("{s: >10} {s: >8} {s: >10} {s: >10}\n", .{ "block size", "pages", "blocks", "in use" }) catch return;
+    for (info.classes) |class| {
+        if (class.pages == 0 and class.used == 0) continue;
+        writer.print("{d: >10} {d: >8} {d: >10} {d: >10}\n", .{ class.block_size, class.pages, class.capacity, class.used }) catch return;
+    }
+    writer.print(
+        \\in use bytes     = {}
+        \\mapped bytes     = {}
+        \\free bytes       = {}
+        \\cached bytes     = {}
+        \\mmap regions     = {}
+        \\mmap bytes       = {}
+        \\huge page bytes  = {}
+        \\
+    , .{
+        info.in_use,
+        info.segment_bytes,
+        info.segment_bytes -| info.in_use,
+        info.cached_bytes,
+        info.huge_count,
+        info.huge_bytes,
+        info.huge_page_bytes,
+    }) catch return;
+}
+
+// pad is ignored, there is no single heap top to leave padding at
+export fn malloc_trim(pad: usize) callconv(.C) c_int {
+    trace.log("malloc_trim {}", .{pad});
+    return @intFromBool(malloc_impl.trim());
+}
+
+export fn memalign(alignment: usize, size: usize) callconv(.C) ?[*]align(alloc_align) u8 {
+    trace.log("memalign {} {}", .{ alignment, size });
+    if (@popCount(alignment) != 1) {
+        errno = c.EINVAL;
+        return null;
+    }
+    return mallocAligned(alignment, size, @returnAddress());
+}
+
+export fn valloc(size: usize) callconv(.C) ?[*]align(alloc_align) u8 {
+    return mallocAligned(std.mem.page_size, size, @returnAddress());
+}
+
+export fn pvalloc(size: usize) callconv(.C) ?[*]align(alloc_align) u8 {
+    if (size > std.math.maxInt(usize) - std.mem.page_size) {
+        errno = c.ENOMEM;
+        return null;
+    }
+    const rounded = std.mem.alignForward(usize, @max(size, 1), std.mem.page_size);
+    return mallocAligned(std.mem.page_size, rounded, @returnAddress());
+}
+
+export fn malloc_usable_size(ptr: ?[*]align(alloc_align) u8) callconv(.C) usize {
+    return malloc_impl.usableSize(ptr orelse return 0);
 }
 
 export fn srand(seed: c_uint) callconv(.C) void {
@@ -235,9 +346,30 @@ export fn atoi(nptr: [*:0]const u8) callconv(.C) c_int {
 // --------------------------------------------------------------------------------
 // string
 // --------------------------------------------------------------------------------
+// The mem functions don't trace, the trace code calls them itself.  These
+// strong exports take the place of the weak ones in compiler_rt.
+export fn memcpy(noalias dest: [*]u8, noalias src: [*]const u8, n: usize) callconv(.C) [*]u8 {
+    if (n != 0) simd.copy(dest, src, n);
+    return dest;
+}
+
+export fn memmove(dest: [*]u8, src: [*]const u8, n: usize) callconv(.C) [*]u8 {
+    if (n != 0) simd.move(dest, src, n);
+    return dest;
+}
+
+export fn memset(dest: [*]u8, char: c_int, n: usize) callconv(.C) [*]u8 {
+    if (n != 0) simd.set(dest, @truncate(@as(c_uint, @bitCast(char))), n);
+    return dest;
+}
+
+export fn memcmp(a: [*]const u8, b: [*]const u8, n: usize) callconv(.C) c_int {
+    return if (n == 0) 0 else simd.active.compare(a, b, n);
+}
+
 export fn strlen(s: [*:0]const u8) callconv(.C) usize {
     trace.log("strlen {}", .{trace.fmtStr(s)});
-    const result = std.mem.len(s);
+    const result = simd.active.strlen(s);
     trace.log("strlen return {}", .{result});
     return result;
 }
@@ -245,21 +377,14 @@ export fn strlen(s: [*:0]const u8) callconv(.C) usize {
 //       I should probably move it to the posix lib
 fn strnlen(s: [*:0]const u8, max_len: usize) usize {
     trace.log("strnlen {*} max={}", .{ s, max_len });
-    var i: usize = 0;
-    while (i < max_len and s[i] != 0) : (i += 1) {}
-    trace.log("strnlen return {}", .{i});
-    return i;
+    const result = simd.active.strnlen(s, max_len);
+    trace.log("strnlen return {}", .{result});
+    return result;
 }
 
 export fn strcmp(a: [*:0]const u8, b: [*:0]const u8) callconv(.C) c_int {
     trace.log("strcmp {} {}", .{ trace.fmtStr(a), trace.fmtStr(b) });
-    var a_next = a;
-    var b_next = b;
-    while (a_next[0] == b_next[0] and a_next[0] != 0) {
-        a_next += 1;
-        b_next += 1;
-    }
-    const result = @as(c_int, @intCast(a_next[0])) -| @as(c_int, @intCast(b_next[0]));
+    const result = simd.active.strcmp(a, b);
     trace.log("strcmp return {}", .{result});
     return result;
 }
@@ -281,41 +406,47 @@ export fn strcoll(s1: [*:0]const u8, s2: [*:0]const u8) callconv(.C) c_int {
 
 export fn strchr(s: [*:0]const u8, char: c_int) callconv(.C) ?[*:0]const u8 {
     trace.log("strchr {} c='{}'", .{ trace.fmtStr(s), char });
-    var next = s;
-    while (true) : (next += 1) {
-        if (next[0] == char) return next;
-        if (next[0] == 0) return null;
-    }
+    return simd.active.strchr(s, @truncate(@as(c_uint, @bitCast(char))));
 }
 export fn memchr(s: [*]const u8, char: c_int, n: usize) callconv(.C) ?[*]const u8 {
     trace.log("memchr {*} c='{}' n={}", .{ s, char, n });
-    var i: usize = 0;
-    while (true) : (i += 1) {
-        if (i == n) return null;
-        if (s[i] == char) return s + i;
-    }
+    return simd.active.memchr(s, @truncate(@as(c_uint, @bitCast(char))), n);
 }
 
 export fn strrchr(s: [*:0]const u8, char: c_int) callconv(.C) ?[*:0]const u8 {
     trace.log("strrchr {} c='{}'", .{ trace.fmtStr(s), char });
-    var next = s + strlen(s);
-    while (true) {
-        if (next[0] == char) return next;
-        if (next == s) return null;
-        next = next - 1;
-    }
+    return simd.active.strrchr(s, @truncate(@as(c_uint, @bitCast(char))));
 }
 
 export fn strstr(s1: [*:0]const u8, s2: [*:0]const u8) callconv(.C) ?[*:0]const u8 {
     trace.log("strstr {} {}", .{ trace.fmtStr(s1), trace.fmtStr(s2) });
-    const s1_len = strlen(s1);
-    const s2_len = strlen(s2);
-    var i: usize = 0;
-    while (i + s2_len <= s1_len) : (i += 1) {
-        const search = s1 + i;
-        if (0 == strncmp(search, s2, s2_len)) return search;
-    }
-    return null;
+    const i = strsearch.find(s1[0..strlen(s1)], s2[0..strlen(s2)], false) orelse return null;
+    return s1 + i;
+}
+
+// NOTE: memmem, memrchr, rawmemchr and strcasestr are GNU extensions (memmem
+//       is also in POSIX 2024), glibc declares them in <string.h>
+export fn memmem(hay: [*]const u8, hay_len: usize, needle: [*]const u8, needle_len: usize) callconv(.C) ?[*]const u8 {
+    trace.log("memmem {*} len={} needle={*} len={}", .{ hay, hay_len, needle, needle_len });
+    const i = strsearch.find(hay[0..hay_len], needle[0..needle_len], false) orelse return null;
+    return hay + i;
+}
+
+export fn strcasestr(s1: [*:0]const u8, s2: [*:0]const u8) callconv(.C) ?[*:0]const u8 {
+    trace.log("strcasestr {} {}", .{ trace.fmtStr(s1), trace.fmtStr(s2) });
+    const i = strsearch.find(s1[0..strlen(s1)], s2[0..strlen(s2)], true) orelse return null;
+    return s1 + i;
+}
+
+export fn memrchr(s: [*]const u8, char: c_int, n: usize) callconv(.C) ?[*]const u8 {
+    trace.log("memrchr {*} c='{}' n={}", .{ s, char, n });
+    return simd.active.memrchr(s, @truncate(@as(c_uint, @bitCast(char))), n);
+}
+
+export fn rawmemchr(s: [*]const u8, char: c_int) callconv(.C) [*]const u8 {
+    trace.log("rawmemchr {*} c='{}'", .{ s, char });
+    // the caller knows the byte is there, so there's no end to stop at
+    return simd.active.memchr(s, @truncate(@as(c_uint, @bitCast(char))), std.math.maxInt(usize)).?;
 }
 
 export fn strcpy(s1: [*]u8, s2: [*:0]const u8) callconv(.C) [*:0]u8 {
@@ -370,49 +501,104 @@ export fn strncat(s1: [*:0]u8, s2: [*:0]const u8, n: usize) callconv(.C) [*:0]u8
     return s1;
 }
 
+/// The bytes of a strspn style set.  Up to small_set_max of them are
+/// compared a block at a time by the vector kernels, a larger set gets a
+/// 256-bit table so every byte of the string is one lookup.
+const ByteSet = struct {
+    const small_set_max = 8;
+
+    set: [*:0]const u8,
+    len: usize,
+    bits: [4]u64,
+
+    fn init(set: [*:0]const u8) ByteSet {
+        var result = ByteSet{ .set = set, .len = simd.active.strnlen(set, small_set_max + 1), .bits = undefined };
+        if (result.len > small_set_max) {
+            result.bits = [_]u64{0} ** 4;
+            var next = set;
+            while (next[0] != 0) : (next += 1) {
+                result.bits[next[0] >> 6] |= @as(u64, 1) << @as(u6, @truncate(next[0]));
+            }
+        }
+        return result;
+    }
+
+    inline fn has(self: *const ByteSet, byte: u8) bool {
+        return 0 != self.bits[byte >> 6] & (@as(u64, 1) << @as(u6, @truncate(byte)));
+    }
+
+    /// The length of the start of s made of bytes in the set, or with
+    /// reject, of bytes not in the set
+    fn span(self: *const ByteSet, s: [*:0]const u8, comptime reject: bool) usize {
+        if (self.len <= small_set_max) {
+            const kernel = if (reject) simd.active.cspan else simd.active.span;
+            return kernel(s, self.set, self.len);
+        }
+        var i: usize = 0;
+        if (reject) {
+            while (s[i] != 0 and !self.has(s[i])) i += 1;
+        } else {
+            // 0 is never in the set
+            while (self.has(s[i])) i += 1;
+        }
+        return i;
+    }
+};
+
 export fn strspn(s1: [*:0]const u8, s2: [*:0]const u8) callconv(.C) usize {
     trace.log("strspn {} {}", .{ trace.fmtStr(s1), trace.fmtStr(s2) });
-    var spn: usize = 0;
-    while (true) : (spn += 1) {
-        if (s1[spn] == 0 or null == strchr(s2, s1[spn])) return spn;
-    }
+    return ByteSet.init(s2).span(s1, false);
 }
 
 export fn strcspn(s1: [*:0]const u8, s2: [*:0]const u8) callconv(.C) usize {
     trace.log("strcspn {} {}", .{ trace.fmtStr(s1), trace.fmtStr(s2) });
-    var spn: usize = 0;
-    while (true) : (spn += 1) {
-        if (s1[spn] == 0 or null != strchr(s2, s1[spn])) return spn;
-    }
+    return ByteSet.init(s2).span(s1, true);
 }
 
 export fn strpbrk(s1: [*:0]const u8, s2: [*:0]const u8) callconv(.C) ?[*]const u8 {
     trace.log("strpbrk {} {}", .{ trace.fmtStr(s1), trace.fmtStr(s2) });
-    var next = s1;
-    while (true) : (next += 1) {
-        if (next[0] == 0) return null;
-        if (strchr(s2, next[0]) != null) return next;
-    }
+    const next = s1 + ByteSet.init(s2).span(s1, true);
+    return if (next[0] == 0) null else next;
 }
 
 export fn strtok(s1: ?[*:0]u8, s2: [*:0]const u8) callconv(.C) ?[*:0]u8 {
     if (s1 != null) {
         trace.log("strtok {} {}", .{ trace.fmtStr(s1.?), trace.fmtStr(s2) });
-        global.strtok_ptr = s1;
     } else {
         trace.log("strtok NULL {}", .{trace.fmtStr(s2)});
     }
-    var next = global.strtok_ptr.?;
-    next += strspn(next, s2);
+    return strtok_r(s1, s2, &global.strtok_ptr);
+}
+
+// NOTE: strtok_r is POSIX and strsep comes from BSD, glibc declares both in
+//       <string.h>
+export fn strtok_r(s: ?[*:0]u8, delim: [*:0]const u8, saveptr: *?[*:0]u8) callconv(.C) ?[*:0]u8 {
+    trace.log("strtok_r {} save={*}", .{ trace.fmtStr(delim), saveptr });
+    var next = s orelse saveptr.* orelse return null;
+    const delims = ByteSet.init(delim);
+    next += delims.span(next, false);
     if (next[0] == 0) {
+        saveptr.* = next;
         return null;
     }
-    const start = next;
-    const end = start + 1 + strcspn(start + 1, s2);
+    const end = next + delims.span(next, true);
+    if (end[0] == 0) {
+        saveptr.* = end;
+    } else {
+        saveptr.* = end + 1;
+        end[0] = 0;
+    }
+    return next;
+}
+
+export fn strsep(stringp: *?[*:0]u8, delim: [*:0]const u8) callconv(.C) ?[*:0]u8 {
+    trace.log("strsep {*} {}", .{ stringp, trace.fmtStr(delim) });
+    const start = stringp.* orelse return null;
+    const end = start + ByteSet.init(delim).span(start, true);
     if (end[0] == 0) {
-        global.strtok_ptr = end;
+        stringp.* = null;
     } else {
-        global.strtok_ptr = end + 1;
+        stringp.* = end + 1;
         end[0] = 0;
     }
     return start;
@@ -592,38 +778,41 @@ export fn signal(sig: c_int, func: SignalFn) callconv(.C) ?SignalFn {
 const global = struct {
     var rand: std.rand.DefaultPrng = undefined;
 
-    var gpa = std.heap.GeneralPurposeAllocator(.{
-        .MutexType = std.Thread.Mutex,
-    }){};
-
-    var strtok_ptr: ?[*:0]u8 = undefined;
-
-    // TODO: remove this global limit on file handles
-    //       probably do an array of pages holding the file objects.
-    //       the address to any file can be done in O(1) by decoding
-    //       the page index and file offset
-    const max_file_count = 100;
-    var files_reserved: [max_file_count]bool = [_]bool{false} ** max_file_count;
-    var files: [max_file_count]c.FILE = [_]c.FILE{
-        .{ .fd = if (builtin.os.tag == .windows) undefined else std.os.STDIN_FILENO, .eof = 0, .errno = undefined },
-        .{ .fd = if (builtin.os.tag == .windows) undefined else std.os.STDOUT_FILENO, .eof = 0, .errno = undefined },
-        .{ .fd = if (builtin.os.tag == .windows) undefined else std.os.STDERR_FILENO, .eof = 0, .errno = undefined },
-    } ++ ([_]c.FILE{undefined} ** (max_file_count - 3));
-
-    fn reserveFile() *c.FILE {
-        var i: usize = 0;
-        while (i < files_reserved.len) : (i += 1) {
-            if (!@atomicRmw(bool, &files_reserved[i], .Xchg, true, .SeqCst)) {
-                return &files[i];
-            }
+    /// per thread, a thread's strtok doesn't disturb another's
+    threadlocal var strtok_ptr: ?[*:0]u8 = null;
+
+    var std_files = [_]c.FILE{
+        stdFile(if (builtin.os.tag == .windows) undefined else std.os.STDIN_FILENO, c._IOFBF, 0),
+        stdFile(if (builtin.os.tag == .windows) undefined else std.os.STDOUT_FILENO, c._IOFBF, file_flag.detect_mode),
+        stdFile(if (builtin.os.tag == .windows) undefined else std.os.STDERR_FILENO, c._IONBF, 0),
+    };
+
+    fn stdFile(fd: anytype, buf_mode: c_int, flags: c_int) c.FILE {
+        var file = std.mem.zeroes(c.FILE);
+        file.fd = fd;
+        file.buf_mode = buf_mode;
+        file.flags = flags;
+        return file;
+    }
+
+    fn reserveFile() ?*c.FILE {
+        const file = file_pool.reserve() orelse return null;
+        // flushAll can be holding or waiting on the lock of a slot that was
+        // just closed, so everything but the lock is reset while holding it.
+        // fclose left nothing to flush.
+        lockStream(file);
+        defer unlockStream(file);
+        // new streams are fully buffered, the buffer is allocated on first use
+        inline for (std.meta.fields(c.FILE)) |field| {
+            if (comptime std.mem.startsWith(u8, field.name, "lock")) continue;
+            @field(file, field.name) = std.mem.zeroes(field.type);
         }
-        @panic("out of file handles");
+        return file;
     }
     fn releaseFile(file: *c.FILE) void {
-        const i = (@intFromPtr(file) - @intFromPtr(&files[0])) / @sizeOf(usize);
-        if (!@atomicRmw(bool, &files_reserved[i], .Xchg, false, .SeqCst)) {
-            std.debug.panic("released FILE (i={} ptr={*}) that was not reserved", .{ i, file });
-        }
+        // stdin, stdout and stderr aren't in the pool
+        if (@intFromPtr(file) -% @intFromPtr(&std_files) < @sizeOf(@TypeOf(std_files))) return;
+        file_pool.release(file);
     }
 
     // TODO: remove this.  Just using it to return error numbers as strings for now
@@ -667,14 +856,488 @@ const global = struct {
     };
 };
 
-export const stdin: *c.FILE = &global.files[0];
-export const stdout: *c.FILE = &global.files[1];
-export const stderr: *c.FILE = &global.files[2];
+export const stdin: *c.FILE = &global.std_files[0];
+export const stdout: *c.FILE = &global.std_files[1];
+export const stderr: *c.FILE = &global.std_files[2];
+
+/// Every FILE from fopen and fdopen lives in a pool of pages that are never
+/// freed.  Page k holds first_page_len << k files, so the pool grows with
+/// the number of open streams and a slot index maps to its page in O(1).
+/// Free slots form a lock-free stack, only adding a page takes a lock.
+const file_pool = struct {
+    const first_page_len = 64;
+    /// keeps every slot index in a u32, that's over 4 billion files
+    const page_count = 26;
+
+    const Slot = struct {
+        file: c.FILE,
+        index: u32,
+        /// index + 1 of the next free slot, 0 ends the stack
+        next_free: u32,
+        reserved: bool,
+    };
+
+    var pages = [_]?[*]Slot{null} ** page_count;
+    var pages_used: usize = 0;
+    var grow_mutex = std.Thread.Mutex{};
+    /// number of slots in the pages that have been added
+    var slot_count: u32 = 0;
+    /// the low 32 bits are the index + 1 of the first free slot, the high
+    /// 32 bits count pops so a stale compare-exchange can't succeed (ABA)
+    var free_head: u64 = 0;
+
+    fn pageStart(page: usize) u32 {
+        return @intCast(first_page_len * ((@as(usize, 1) << @intCast(page)) - 1));
+    }
+
+    fn slot(index: u32) *Slot {
+        const page = std.math.log2_int(u32, index / first_page_len + 1);
+        return &pages[page].?[index - pageStart(page)];
+    }
+
+    fn reserve() ?*c.FILE {
+        while (true) {
+            var head = @atomicLoad(u64, &free_head, .Acquire);
+            while (@as(u32, @truncate(head)) != 0) {
+                const s = slot(@as(u32, @truncate(head)) - 1);
+                const next = @atomicLoad(u32, &s.next_free, .Monotonic);
+                const new_head = ((head +% (1 << 32)) & ~@as(u64, 0xffffffff)) | next;
+                head = @cmpxchgWeak(u64, &free_head, head, new_head, .Acquire, .Acquire) orelse {
+                    @atomicStore(bool, &s.reserved, true, .Monotonic);
+                    return &s.file;
+                };
+            }
+            if (!grow()) return null;
+        }
+    }
+
+    fn release(file: *c.FILE) void {
+        const s = @fieldParentPtr(Slot, "file", file);
+        if (!@atomicRmw(bool, &s.reserved, .Xchg, false, .Monotonic)) {
+            std.debug.panic("released FILE (i={} ptr={*}) that was not reserved", .{ s.index, file });
+        }
+        push(s.index + 1, s);
+    }
+
+    /// Pushes the chain of free slots from first to last, linked through
+    /// next_free, with first_link being the index + 1 of first.
+    fn push(first_link: u32, last: *Slot) void {
+        var head = @atomicLoad(u64, &free_head, .Monotonic);
+        while (true) {
+            @atomicStore(u32, &last.next_free, @truncate(head), .Monotonic);
+            const new_head = (head & ~@as(u64, 0xffffffff)) | first_link;
+            head = @cmpxchgWeak(u64, &free_head, head, new_head, .Release, .Monotonic) orelse return;
+        }
+    }
+
+    /// Adds a page, returns false when out of memory
+    fn grow() bool {
+        grow_mutex.lock();
+        defer grow_mutex.unlock();
+        // another thread may have added a page while this one waited
+        if (@as(u32, @truncate(@atomicLoad(u64, &free_head, .Acquire))) != 0) return true;
+        if (pages_used == page_count) return false;
+
+        const page = pages_used;
+        const start = pageStart(page);
+        const slots = std.heap.page_allocator.alloc(Slot, @as(usize, first_page_len) << @intCast(page)) catch return false;
+        for (slots, start..) |*s, index| {
+            s.* = .{
+                // flushAll and reserveFile can take the lock of any slot
+                .file = std.mem.zeroes(c.FILE),
+                .index = @intCast(index),
+                .next_free = @intCast(index + 2),
+                .reserved = false,
+            };
+        }
+        @atomicStore(?[*]Slot, &pages[page], slots.ptr, .Release);
+        pages_used += 1;
+        @atomicStore(u32, &slot_count, start + @as(u32, @intCast(slots.len)), .Release);
+        push(start + 1, &slots[slots.len - 1]);
+        return true;
+    }
+};
+
+/// Private bits in FILE.flags
+const file_flag = struct {
+    /// buf was allocated by the libc and is freed with the stream
+    const own_buf = 1 << 0;
+    /// the buffering mode is picked on first write, line buffered for a
+    /// terminal and fully buffered otherwise, set for stdout
+    const detect_mode = 1 << 1;
+    /// FILE.offset holds the offset of the underlying file
+    const offset_known = 1 << 2;
+    /// ungetc put a byte in the read buffer that isn't in the file
+    const pushback = 1 << 3;
+    /// writes go to the end of the file
+    const append = 1 << 4;
+};
+
+/// Same name and meaning as in glibc's sys/single_threaded.h, programs can
+/// skip their own atomics while it's set.  pthread_create clears it before
+/// the new thread starts.  Like glibc, the stdio functions skip the stream
+/// lock while it's set, threads started some other way don't count.
+export var __libc_single_threaded: u8 = 1;
+
+/// its address is different on every thread, which makes it a thread id
+threadlocal var thread_marker: u8 = 0;
+
+/// True if the stdio functions can leave the stream unlocked.  A lock this
+/// thread already holds, from flockfile, is still counted.  No other
+/// thread can start in the middle of a stdio call, so its unlock sees the
+/// same answer.
+fn skipStreamLock(stream: *c.FILE) bool {
+    return @atomicLoad(u8, &__libc_single_threaded, .Monotonic) != 0 and
+        @atomicLoad(?*anyopaque, &stream.lock_owner, .Monotonic) != @as(?*anyopaque, &thread_marker);
+}
+
+/// Takes the recursive stream lock if it's free or already held by this
+/// thread, or skips it while the program is single-threaded.
+fn tryLockStream(stream: *c.FILE) bool {
+    return skipStreamLock(stream) or tryAcquireStream(stream);
+}
+
+fn lockStream(stream: *c.FILE) void {
+    if (!skipStreamLock(stream)) acquireStream(stream);
+}
+
+/// Releases the stream lock if this thread holds it, a skipped lock has no
+/// owner so there's nothing to do.
+fn unlockStream(stream: *c.FILE) void {
+    if (@atomicLoad(?*anyopaque, &stream.lock_owner, .Monotonic) != @as(?*anyopaque, &thread_marker)) return;
+    releaseStream(stream);
+}
+
+/// Takes the recursive stream lock if it's free or already held by this
+/// thread.  Uncontended, that's one compare and swap.
+fn tryAcquireStream(stream: *c.FILE) bool {
+    const self: ?*anyopaque = &thread_marker;
+    if (@atomicLoad(?*anyopaque, &stream.lock_owner, .Monotonic) == self) {
+        stream.lock_count += 1;
+        return true;
+    }
+    if (@cmpxchgStrong(c_uint, &stream.lock, 0, 1, .Acquire, .Monotonic) != null) {
+        return false;
+    }
+    @atomicStore(?*anyopaque, &stream.lock_owner, self, .Monotonic);
+    stream.lock_count = 1;
+    return true;
+}
+
+/// flockfile always takes the lock, the program can start a thread
+/// before the funlockfile
+fn acquireStream(stream: *c.FILE) void {
+    if (tryAcquireStream(stream)) return;
+    // 0 is unlocked, 1 locked and 2 locked with waiters
+    while (@atomicRmw(c_uint, &stream.lock, .Xchg, 2, .Acquire) != 0) {
+        std.Thread.Futex.wait(@ptrCast(&stream.lock), 2);
+    }
+    @atomicStore(?*anyopaque, &stream.lock_owner, &thread_marker, .Monotonic);
+    stream.lock_count = 1;
+}
+
+fn releaseStream(stream: *c.FILE) void {
+    stream.lock_count -= 1;
+    if (stream.lock_count != 0) return;
+    @atomicStore(?*anyopaque, &stream.lock_owner, null, .Monotonic);
+    if (@atomicRmw(c_uint, &stream.lock, .Xchg, 0, .Release) == 2) {
+        std.Thread.Futex.wake(@ptrCast(&stream.lock), 1);
+    }
+}
+
+export fn flockfile(stream: *c.FILE) callconv(.C) void {
+    acquireStream(stream);
+}
+
+export fn ftrylockfile(stream: *c.FILE) callconv(.C) c_int {
+    return if (tryAcquireStream(stream)) 0 else -1;
+}
+
+export fn funlockfile(stream: *c.FILE) callconv(.C) void {
+    releaseStream(stream);
+}
+
+fn isatty(stream: *c.FILE) bool {
+    if (builtin.os.tag == .windows) return std.os.isatty(stream.fd orelse return false);
+    return std.os.isatty(stream.fd);
+}
+
+/// The size of the stream buffer, allocated or not
+fn bufferSize(stream: *c.FILE) usize {
+    // buf_size can hold a size requested with setvbuf
+    return if (stream.buf_size == 0) c.BUFSIZ else stream.buf_size;
+}
+
+fn allocBuffer(stream: *c.FILE) bool {
+    if (stream.buf != null) return true;
+    const size = bufferSize(stream);
+    stream.buf = malloc_impl.alloc(size) orelse return false;
+    stream.buf_size = size;
+    stream.flags |= file_flag.own_buf;
+    return true;
+}
+
+/// Gets the stream ready for output.  Returns false if the stream is
+/// unbuffered, otherwise makes sure it has a buffer.
+fn prepareWrite(stream: *c.FILE) bool {
+    if (!dropReadBuffer(stream)) {
+        // the file can't seek back to where the program is reading
+        stream.rpos = null;
+        stream.rend = null;
+    }
+    if (stream.flags & file_flag.detect_mode != 0) {
+        stream.flags &= ~@as(c_int, file_flag.detect_mode);
+        stream.buf_mode = if (isatty(stream)) c._IOLBF else c._IOFBF;
+    }
+    if (stream.buf_mode == c._IONBF) return false;
+    if (!allocBuffer(stream)) {
+        stream.buf_mode = c._IONBF;
+        return false;
+    }
+    return true;
+}
+
+fn freeBuffer(stream: *c.FILE) void {
+    if (stream.flags & file_flag.own_buf != 0) {
+        malloc_impl.free(@ptrCast(@alignCast(stream.buf)));
+        stream.flags &= ~@as(c_int, file_flag.own_buf);
+    }
+    stream.buf = null;
+    stream.buf_size = 0;
+    stream.buf_len = 0;
+    stream.rpos = null;
+    stream.rend = null;
+}
+
+/// Writes the pending output in the stream buffer.  On error, whatever
+/// wasn't written stays in the buffer.
+fn flushBuffer(stream: *c.FILE) bool {
+    if (stream.buf_len == 0) return true;
+    const pending = stream.buf[0..stream.buf_len];
+    const written = writeDirect(stream, pending);
+    if (written != pending.len) {
+        std.mem.copyForwards(u8, pending[0 .. pending.len - written], pending[written..]);
+        stream.buf_len = pending.len - written;
+        return false;
+    }
+    stream.buf_len = 0;
+    return true;
+}
+
+fn flushAll() c_int {
+    var result: c_int = 0;
+    for (&global.std_files) |*file| {
+        lockStream(file);
+        defer unlockStream(file);
+        if (!flushBuffer(file)) result = c.EOF;
+    }
+    const slot_count = @atomicLoad(u32, &file_pool.slot_count, .Acquire);
+    var i: u32 = 0;
+    while (i < slot_count) : (i += 1) {
+        const s = file_pool.slot(i);
+        if (!@atomicLoad(bool, &s.reserved, .Monotonic)) continue;
+        // the stream can be closed and its slot reused while this waits,
+        // reserveFile keeps the lock and a closed stream has nothing to flush
+        lockStream(&s.file);
+        defer unlockStream(&s.file);
+        if (!flushBuffer(&s.file)) result = c.EOF;
+    }
+    return result;
+}
+
+/// Reading from a stream flushes stdout first if it's line buffered so
+/// a prompt shows up before the program waits for input.  Like glibc it's
+/// skipped while another thread has stdout locked, waiting for it would
+/// deadlock a program that reads while holding flockfile(stdout).
+fn flushLineBuffered() void {
+    if (!tryLockStream(stdout)) return;
+    defer unlockStream(stdout);
+    if (stdout.buf_mode == c._IOLBF) _ = flushBuffer(stdout);
+}
+
+/// The input in the read buffer, only call when stream.rpos != stream.rend
+fn bufferedInput(stream: *c.FILE) []u8 {
+    return stream.rpos[0 .. @intFromPtr(stream.rend) - @intFromPtr(stream.rpos)];
+}
+
+/// Reads the next chunk of the file into the stream buffer.  Returns false
+/// at end of file or on error, which set stream.eof or stream.errno.
+/// Reading and writing share the buffer, pending output is flushed first.
+fn fillReadBuffer(stream: *c.FILE) bool {
+    if (!prepareRead(stream)) return false;
+    const input = if (fileOps(stream).window) |window| blk: {
+        // the file is already in memory, read it from there
+        const rest = window(stream);
+        advanceOffset(stream, rest.len, false);
+        if (rest.len == 0) stream.eof = 1;
+        break :blk rest;
+    } else blk: {
+        if (!allocBuffer(stream)) {
+            stream.errno = c.ENOMEM;
+            return false;
+        }
+        break :blk stream.buf[0..readDirect(stream, stream.buf[0..stream.buf_size])];
+    };
+    if (input.len == 0) return false;
+    stream.rbase = input.ptr;
+    stream.rpos = input.ptr;
+    stream.rend = input.ptr + input.len;
+    stream.flags &= ~@as(c_int, file_flag.pushback);
+    return true;
+}
+
+/// Reads into buf without going through the stream buffer, for requests
+/// the buffer can't hold.  Only call when stream.rpos == stream.rend.
+fn readUnbuffered(stream: *c.FILE, buf: []u8) usize {
+    if (!prepareRead(stream)) return 0;
+    // the read buffer doesn't end at the file offset anymore
+    stream.rpos = null;
+    stream.rend = null;
+    return readDirect(stream, buf);
+}
+
+fn prepareRead(stream: *c.FILE) bool {
+    flushLineBuffered();
+    return flushBuffer(stream);
+}
+
+/// Drops the read buffer, moving the file offset back over the input that
+/// wasn't read yet.  Returns false and keeps the input if the file can't
+/// seek, i.e. pipes and terminals, and sets errno.
+fn dropReadBuffer(stream: *c.FILE) bool {
+    if (stream.rpos != stream.rend) {
+        const unread: i64 = @intCast(bufferedInput(stream).len);
+        setOffset(stream, fileOps(stream).seek(stream, -unread, c.SEEK_CUR) orelse return false);
+    }
+    stream.rpos = null;
+    stream.rend = null;
+    return true;
+}
+
+fn setOffset(stream: *c.FILE, offset: i64) void {
+    stream.offset = offset;
+    stream.flags |= file_flag.offset_known;
+}
+
+/// Moves the tracked offset past the bytes of a read or write.  Appending
+/// writes land at the end of the file, which leaves the offset unknown.
+fn advanceOffset(stream: *c.FILE, len: usize, is_write: bool) void {
+    if (is_write and stream.flags & file_flag.append != 0) {
+        stream.flags &= ~@as(c_int, file_flag.offset_known);
+    } else {
+        stream.offset += @intCast(len);
+    }
+}
+
+/// The position the program sees, which is behind the file offset by the
+/// unread input and ahead of it by the pending output.  Asks the file for
+/// its offset the first time, returns null and sets errno if it can't seek.
+fn streamPosition(stream: *c.FILE) ?i64 {
+    if (stream.flags & file_flag.offset_known == 0) {
+        setOffset(stream, fileOps(stream).seek(stream, 0, c.SEEK_CUR) orelse return null);
+    }
+    const unread = @intFromPtr(stream.rend) - @intFromPtr(stream.rpos);
+    return stream.offset - @as(i64, @intCast(unread)) + @as(i64, @intCast(stream.buf_len));
+}
+
+/// fseek without the lock.  Returns false and sets errno on error.
+fn seekStream(stream: *c.FILE, offset: i64, whence: c_int) bool {
+    // a seek that lands in the read buffer only moves the read pointer,
+    // the buffer holds the file from offset - (rend - rbase) up to offset
+    if (stream.rpos != null and (whence == c.SEEK_SET or whence == c.SEEK_CUR) and
+        stream.flags & (file_flag.offset_known | file_flag.pushback) == file_flag.offset_known)
+    {
+        const buffered: i64 = @intCast(@intFromPtr(stream.rend) - @intFromPtr(stream.rbase));
+        const base = if (whence == c.SEEK_SET) 0 else streamPosition(stream).?;
+        if (std.math.add(i64, base, offset)) |target| {
+            if (target >= stream.offset - buffered and target <= stream.offset) {
+                stream.rpos = stream.rend - @as(usize, @intCast(stream.offset - target));
+                stream.eof = 0;
+                return true;
+            }
+        } else |_| {}
+    }
+
+    if (!flushBuffer(stream)) {
+        errno = stream.errno;
+        return false;
+    }
+    var file_offset = offset;
+    var file_whence = whence;
+    if (whence == c.SEEK_CUR) {
+        if (stream.flags & file_flag.offset_known != 0) {
+            // seek from the start rather than moving back over the read buffer first
+            file_offset = std.math.add(i64, streamPosition(stream).?, offset) catch {
+                errno = c.EINVAL;
+                return false;
+            };
+            file_whence = c.SEEK_SET;
+        } else if (!dropReadBuffer(stream)) return false;
+    }
+    // the target doesn't depend on where the file is, so the read buffer is
+    // simply dropped once the seek worked, one syscall.  If it fails the
+    // buffer still matches the file offset.
+    setOffset(stream, fileOps(stream).seek(stream, file_offset, file_whence) orelse return false);
+    stream.rpos = null;
+    stream.rend = null;
+    stream.flags &= ~@as(c_int, file_flag.pushback);
+    stream.eof = 0;
+    return true;
+}
+
+/// How a stream reads, writes, seeks and closes.  FILE.ops points to one,
+/// streams on a file descriptor leave it NULL.
+const FileOps = struct {
+    /// returns 0 at end of file, which sets stream.eof, or on error, which
+    /// sets stream.errno
+    read: *const fn (stream: *c.FILE, buf: []u8) usize,
+    /// returns less than bytes.len on error, which sets stream.errno
+    write: *const fn (stream: *c.FILE, bytes: []const u8) usize,
+    /// returns the new offset, or null on error, which sets errno
+    seek: *const fn (stream: *c.FILE, offset: i64, whence: c_int) ?i64,
+    close: *const fn (stream: *c.FILE) bool,
+    /// for streams that have the file in memory, returns the rest of it
+    /// and moves to the end, the memory becomes the read buffer
+    window: ?*const fn (stream: *c.FILE) []u8 = null,
+};
+
+const fd_ops = FileOps{ .read = readFd, .write = writeFd, .seek = seekFd, .close = closeFd };
+
+fn fileOps(stream: *c.FILE) *const FileOps {
+    const ops = stream.ops orelse return &fd_ops;
+    return @ptrCast(@alignCast(ops));
+}
+
+fn readDirect(stream: *c.FILE, buf: []u8) usize {
+    const len = fileOps(stream).read(stream, buf);
+    advanceOffset(stream, len, false);
+    return len;
+}
+
+/// Writes to the stream without buffering, sets stream.errno if it returns
+/// less than bytes.len.
+fn writeDirect(stream: *c.FILE, bytes: []const u8) usize {
+    const written = fileOps(stream).write(stream, bytes);
+    advanceOffset(stream, written, true);
+    return written;
+}
 
 // used by posix.zig
 export fn __zreserveFile() callconv(.C) ?*c.FILE {
     return global.reserveFile();
 }
+// used by posix.zig
+export fn __zfillReadBuffer(stream: *c.FILE) callconv(.C) bool {
+    return fillReadBuffer(stream);
+}
+// used by posix.zig and printf.c, the stdio lock that's skipped while the
+// program is single-threaded
+export fn __zlockStream(stream: *c.FILE) callconv(.C) void {
+    lockStream(stream);
+}
+export fn __zunlockStream(stream: *c.FILE) callconv(.C) void {
+    unlockStream(stream);
+}
 
 export fn remove(filename: [*:0]const u8) callconv(.C) c_int {
     trace.log("remove {}", .{trace.fmtStr(filename)});
@@ -690,27 +1353,30 @@ export fn getchar() callconv(.C) c_int {
     return getc(stdin);
 }
 
+export fn getchar_unlocked() callconv(.C) c_int {
+    return getc_unlocked(stdin);
+}
+
 export fn getc(stream: *c.FILE) callconv(.C) c_int {
-    if (stream.eof != 0) @panic("getc, eof not 0 not implemented");
-    trace.log("getc {*}", .{stream});
+    lockStream(stream);
+    defer unlockStream(stream);
+    return getc_unlocked(stream);
+}
 
-    if (builtin.os.tag == .windows) {
-        var buf: [1]u8 = undefined;
-        const len = _fread_buf(&buf, 1, stream);
-        if (len == 0) return c.EOF;
-        std.debug.assert(len == 1);
-        return buf[0];
+export fn getc_unlocked(stream: *c.FILE) callconv(.C) c_int {
+    if (stream.rpos != stream.rend) {
+        const ch = stream.rpos[0];
+        stream.rpos += 1;
+        return ch;
     }
-
-    var buf: [1]u8 = undefined;
-    const rc = std.os.system.read(stream.fd, &buf, 1);
-    if (rc == 1) {
-        trace.log("getc return {}", .{buf[0]});
-        return buf[0];
+    trace.log("getc {*}", .{stream});
+    if (stream.eof != 0 or !fillReadBuffer(stream)) {
+        trace.log("getc return EOF, errno={}", .{stream.errno});
+        return c.EOF;
     }
-    stream.errno = if (rc == 0) 0 else @intFromEnum(std.os.errno(rc));
-    trace.log("getc return EOF, errno={}", .{stream.errno});
-    return c.EOF;
+    const ch = stream.rpos[0];
+    stream.rpos += 1;
+    return ch;
 }
 
 // NOTE: this causes a bug in the Zig compiler, but it shouldn't
@@ -722,28 +1388,84 @@ export fn fgetc(stream: *c.FILE) callconv(.C) c_int {
     return getc(stream);
 }
 
+export fn fgetc_unlocked(stream: *c.FILE) callconv(.C) c_int {
+    return getc_unlocked(stream);
+}
+
 export fn ungetc(char: c_int, stream: *c.FILE) callconv(.C) c_int {
-    if (stream.eof != 0) @panic("ungetc, eof not 0 not implemented");
-    _ = char;
-    @panic("ungetc not implemented");
+    trace.log("ungetc {} stream={*}", .{ char, stream });
+    if (char == c.EOF) return c.EOF;
+    const byte: u8 = @truncate(@as(c_uint, @bitCast(char)));
+    lockStream(stream);
+    defer unlockStream(stream);
+    if (stream.rpos != null and stream.rpos != stream.rbase and (stream.rpos - 1)[0] == byte) {
+        // the byte is already there, which is the only way to push back
+        // into a mapped file
+        stream.rpos -= 1;
+        stream.eof = 0;
+        return byte;
+    }
+    if (stream.rpos != stream.rend) {
+        // the pushback has to go in the stream buffer, and there has to be
+        // room before the unread input, which there isn't after a seek to
+        // the start of the buffer.  Give the input back to the file and
+        // start over unless the buffer only holds earlier pushback.
+        const no_room = stream.rpos == stream.rbase and stream.flags & file_flag.pushback == 0;
+        if (stream.rbase != stream.buf or no_room) {
+            if (!dropReadBuffer(stream)) return c.EOF;
+        }
+    }
+    if (stream.rpos == stream.rend) {
+        // start a read buffer with the byte at the end, leaving room for more
+        if (!flushBuffer(stream) or !allocBuffer(stream)) return c.EOF;
+        stream.rbase = stream.buf;
+        stream.rend = stream.buf + stream.buf_size;
+        stream.rpos = stream.rend;
+    } else if (stream.rpos == stream.rbase) {
+        // the buffer is all pushback, C only promises one byte of it
+        return c.EOF;
+    }
+    stream.rpos -= 1;
+    stream.rpos[0] = byte;
+    stream.flags |= file_flag.pushback;
+    stream.eof = 0;
+    return byte;
 }
 
+// NOTE: this is not apart of libc
+// Reads up to size bytes, returns 0 at end of file or on error.
 export fn _fread_buf(ptr: [*]u8, size: usize, stream: *c.FILE) callconv(.C) usize {
-    // TODO: should I check stream.eof here?
+    if (size == 0) return 0;
+    if (stream.rpos == stream.rend) {
+        if (stream.eof != 0) return 0;
+        // no point copying it through the buffer
+        if (size >= bufferSize(stream)) return readUnbuffered(stream, ptr[0..size]);
+        if (!fillReadBuffer(stream)) return 0;
+    }
+    const input = bufferedInput(stream);
+    const len = @min(input.len, size);
+    @memcpy(ptr[0..len], input[0..len]);
+    stream.rpos += len;
+    return len;
+}
 
+fn readFd(stream: *c.FILE, buf: []u8) usize {
     if (builtin.os.tag == .windows) {
-        const actual_read_len = @as(u32, @intCast(@min(@as(u32, std.math.maxInt(u32)), size)));
+        const actual_read_len = @as(u32, @intCast(@min(@as(u32, std.math.maxInt(u32)), buf.len)));
         while (true) {
             var amt_read: u32 = undefined;
             // TODO: is stream.fd.? right?
-            if (std.os.windows.kernel32.ReadFile(stream.fd.?, ptr, actual_read_len, &amt_read, null) == 0) {
+            if (std.os.windows.kernel32.ReadFile(stream.fd.?, buf.ptr, actual_read_len, &amt_read, null) == 0) {
                 switch (std.os.windows.kernel32.GetLastError()) {
                     .OPERATION_ABORTED => continue,
-                    .BROKEN_PIPE => return 0,
-                    .HANDLE_EOF => return 0,
+                    .BROKEN_PIPE, .HANDLE_EOF => {
+                        stream.eof = 1;
+                        return 0;
+                    },
                     else => |err| std.debug.panic("ReadFile unexpected error {}", .{err}),
                 }
             }
+            if (amt_read == 0) stream.eof = 1;
             return @as(usize, @intCast(amt_read));
         }
     }
@@ -754,54 +1476,113 @@ export fn _fread_buf(ptr: [*]u8, size: usize, stream: *c.FILE) callconv(.C) usiz
         .macos, .ios, .watchos, .tvos => std.math.maxInt(i32),
         else => std.math.maxInt(isize),
     };
-    const adjusted_len = @min(max_count, size);
+    const adjusted_len = @min(max_count, buf.len);
 
-    const rc = std.os.system.read(stream.fd, ptr, adjusted_len);
-    switch (std.os.errno(rc)) {
-        .SUCCESS => {
-            if (rc == 0) stream.eof = 1;
-            return @as(usize, @intCast(rc));
-        },
-        else => |e| {
-            errno = @intFromEnum(e);
-            return 0;
-        },
+    while (true) {
+        const rc = std.os.system.read(stream.fd, buf.ptr, adjusted_len);
+        switch (std.os.errno(rc)) {
+            .SUCCESS => {
+                if (rc == 0) stream.eof = 1;
+                return @as(usize, @intCast(rc));
+            },
+            .INTR => continue,
+            else => |e| {
+                stream.errno = @intFromEnum(e);
+                errno = @intFromEnum(e);
+                return 0;
+            },
+        }
     }
 }
 
 export fn fread(ptr: [*]u8, size: usize, nmemb: usize, stream: *c.FILE) callconv(.C) usize {
-    if (stream.eof != 0) @panic("fread, eof not 0 not implemented");
-    const total = size * nmemb;
-    const result = _fread_buf(ptr, total, stream);
-    if (result == 0) return 0;
-    if (result == total) return nmemb;
-    // TODO: if length read is not aligned then we need to leave it
-    //       in an internal read buffer inside FILE
-    //       for now we'll crash if it's not aligned
-    return @divExact(result, size);
+    lockStream(stream);
+    defer unlockStream(stream);
+    return fread_unlocked(ptr, size, nmemb, stream);
+}
+
+export fn fread_unlocked(ptr: [*]u8, size: usize, nmemb: usize, stream: *c.FILE) callconv(.C) usize {
+    const total = std.math.mul(usize, size, nmemb) catch return sizeOverflow(stream);
+    if (total == 0) return 0;
+    // short reads from pipes and terminals are retried, a partial element
+    // stays read like other libcs
+    var done: usize = 0;
+    while (done < total) {
+        const len = _fread_buf(ptr + done, total - done, stream);
+        if (len == 0) break;
+        done += len;
+    }
+    return done / size;
+}
+
+/// fread and fwrite of more than fits in memory
+fn sizeOverflow(stream: *c.FILE) usize {
+    stream.errno = c.EOVERFLOW;
+    errno = c.EOVERFLOW;
+    return 0;
 }
 
 export fn feof(stream: *c.FILE) callconv(.C) c_int {
     return stream.eof;
 }
 
+/// An fopen mode string
+const OpenMode = struct {
+    /// 'r', 'w' or 'a'
+    kind: u8,
+    /// '+', open for reading and writing
+    update: bool = false,
+    /// 'x', fail if the file exists
+    exclusive: bool = false,
+    /// 'e', close the file descriptor on exec
+    cloexec: bool = false,
+    /// 'm', read from a mapping of the file
+    map: bool = false,
+
+    /// Returns null if the mode doesn't start with r, w or a.  Like glibc,
+    /// it ignores characters it doesn't know after that, 'b' among them.
+    fn parse(mode: [*:0]const u8) ?OpenMode {
+        var result = OpenMode{ .kind = mode[0] };
+        switch (mode[0]) {
+            'r', 'w', 'a' => {},
+            else => return null,
+        }
+        for (std.mem.span(mode + 1)) |mode_char| switch (mode_char) {
+            '+' => result.update = true,
+            'x' => result.exclusive = true,
+            'e' => result.cloexec = true,
+            'm' => result.map = true,
+            else => {},
+        };
+        return result;
+    }
+
+    fn readOnly(self: OpenMode) bool {
+        return self.kind == 'r' and !self.update;
+    }
+};
+
 pub export fn fopen(filename: [*:0]const u8, mode: [*:0]const u8) callconv(.C) ?*c.FILE {
     trace.log("fopen {} mode={}", .{ trace.fmtStr(filename), trace.fmtStr(mode) });
+    const open_mode = OpenMode.parse(mode) orelse {
+        errno = c.EINVAL;
+        return null;
+    };
     if (builtin.os.tag == .windows) {
-        var create_disposition: u32 = std.os.windows.OPEN_EXISTING;
-        var access: u32 = 0;
-        for (std.mem.span(mode)) |mode_char| {
-            if (mode_char == 'r') {
-                access |= std.os.windows.GENERIC_READ;
-            } else if (mode_char == 'w') {
-                access |= std.os.windows.GENERIC_WRITE;
-                create_disposition = std.os.windows.CREATE_ALWAYS;
-            } else if (mode_char == 'b') {
-                // not really sure what this is supposed to do yet, ignore it for now
-            } else {
-                std.debug.panic("unhandled open flag '{c}' (from {})", .{ mode_char, trace.fmtStr(mode) });
-            }
+        var access: u32 = switch (open_mode.kind) {
+            'r' => std.os.windows.GENERIC_READ,
+            'w' => std.os.windows.GENERIC_WRITE,
+            else => windows.FILE_APPEND_DATA,
+        };
+        if (open_mode.update) {
+            access |= std.os.windows.GENERIC_READ;
+            if (open_mode.kind != 'a') access |= std.os.windows.GENERIC_WRITE;
         }
+        const create_disposition: u32 = switch (open_mode.kind) {
+            'r' => std.os.windows.OPEN_EXISTING,
+            'w' => if (open_mode.exclusive) std.os.windows.CREATE_NEW else std.os.windows.CREATE_ALWAYS,
+            else => if (open_mode.exclusive) std.os.windows.CREATE_NEW else std.os.windows.OPEN_ALWAYS,
+        };
         const fd = windows.CreateFileA(
             filename,
             access,
@@ -818,24 +1599,24 @@ pub export fn fopen(filename: [*:0]const u8, mode: [*:0]const u8) callconv(.C) ?
             errno = @intFromEnum(std.os.windows.kernel32.GetLastError());
             return null;
         }
-        const file = global.reserveFile();
+        const file = global.reserveFile() orelse {
+            std.os.close(fd.?);
+            errno = c.ENOMEM;
+            return null;
+        };
         file.fd = fd;
-        file.eof = 0;
+        initOpenedFile(file, open_mode);
         return file;
     }
 
-    var flags: u32 = 0;
-    for (std.mem.span(mode)) |mode_char| {
-        if (mode_char == 'r') {
-            flags |= std.os.O.RDONLY;
-        } else if (mode_char == 'w') {
-            flags |= std.os.O.WRONLY | std.os.O.CREAT | std.os.O.TRUNC;
-        } else if (mode_char == 'b') {
-            // not really sure what this is supposed to do yet, ignore it for now
-        } else {
-            std.debug.panic("unhandled open flag '{c}' (from {})", .{ mode_char, trace.fmtStr(mode) });
-        }
-    }
+    var flags: u32 = switch (open_mode.kind) {
+        'r' => std.os.O.RDONLY,
+        'w' => std.os.O.WRONLY | std.os.O.CREAT | std.os.O.TRUNC,
+        else => std.os.O.WRONLY | std.os.O.CREAT | std.os.O.APPEND,
+    };
+    if (open_mode.update) flags = (flags & ~@as(u32, std.os.O.WRONLY)) | std.os.O.RDWR;
+    if (open_mode.exclusive) flags |= std.os.O.EXCL;
+    if (open_mode.cloexec) flags |= std.os.O.CLOEXEC;
     const fd = std.os.system.open(filename, flags, 0o666);
     switch (std.os.errno(fd)) {
         .SUCCESS => {},
@@ -845,12 +1626,146 @@ pub export fn fopen(filename: [*:0]const u8, mode: [*:0]const u8) callconv(.C) ?
             return null;
         },
     }
-    const file = global.reserveFile();
+    const file = global.reserveFile() orelse {
+        std.os.close(@intCast(fd));
+        errno = c.ENOMEM;
+        return null;
+    };
     file.fd = @as(c_int, @intCast(fd));
-    file.eof = 0;
+    initOpenedFile(file, open_mode);
+    if (open_mode.readOnly()) {
+        if ((open_mode.map or mapTunable()) and mapFile(file)) return file;
+        if (builtin.os.tag == .linux) {
+            // a file opened only for reading is usually read front to back, let
+            // the kernel read further ahead.  It's only a hint, errors don't matter.
+            _ = std.os.linux.fadvise(file.fd, 0, 0, std.os.linux.POSIX_FADV.SEQUENTIAL);
+        }
+    }
     return file;
 }
 
+fn initOpenedFile(file: *c.FILE, open_mode: OpenMode) void {
+    if (open_mode.kind == 'a') {
+        // every write moves the offset to the end of the file
+        file.flags |= file_flag.append;
+    } else {
+        // a new file descriptor starts at the beginning of the file
+        file.flags |= file_flag.offset_known;
+    }
+}
+
+/// Set ZIGLIBC_STDIO_MMAP=1 to map every file fopen opens read-only, like
+/// the "m" mode does for a single file.
+const Tunable = enum(u8) { unknown, off, on };
+var map_tunable = Tunable.unknown;
+
+fn mapTunable() bool {
+    switch (@atomicLoad(Tunable, &map_tunable, .Monotonic)) {
+        .off => return false,
+        .on => return true,
+        .unknown => {
+            const value = std.os.getenv("ZIGLIBC_STDIO_MMAP") orelse "0";
+            const enabled = !std.mem.eql(u8, value, "0");
+            @atomicStore(Tunable, &map_tunable, if (enabled) .on else .off, .Monotonic);
+            return enabled;
+        },
+    }
+}
+
+/// The state of a stream fopen mapped, in FILE.cookie.  The mapping itself
+/// is the read buffer, getc, fgets and small freads read straight out of it.
+/// Like other libcs, a file that shrinks while it's mapped can crash the
+/// program with SIGBUS.
+const MappedFile = struct {
+    data: []align(std.mem.page_size) const u8,
+    pos: usize = 0,
+
+    fn get(stream: *c.FILE) *MappedFile {
+        return @ptrCast(@alignCast(stream.cookie.?));
+    }
+};
+
+const map_ops = FileOps{
+    .read = mapRead,
+    .write = mapWrite,
+    .seek = mapSeek,
+    .close = mapClose,
+    .window = mapWindow,
+};
+
+/// Maps the file of a read-only stream.  Returns false and leaves the stream
+/// reading the file descriptor if it's not a regular file or mmap fails.
+fn mapFile(stream: *c.FILE) bool {
+    const stat = std.os.fstat(stream.fd) catch return false;
+    if (!std.os.S.ISREG(stat.mode) or stat.size <= 0) return false;
+    const len = std.math.cast(usize, stat.size) orelse return false;
+    const m: *MappedFile = @ptrCast(malloc_impl.alloc(@sizeOf(MappedFile)) orelse return false);
+    const data = std.os.mmap(null, len, std.os.PROT.READ, std.os.MAP.PRIVATE, stream.fd, 0) catch {
+        malloc_impl.free(@ptrCast(@alignCast(m)));
+        return false;
+    };
+    m.* = .{ .data = data };
+    stream.ops = &map_ops;
+    stream.cookie = m;
+    return true;
+}
+
+fn mapRead(stream: *c.FILE, buf: []u8) usize {
+    const m = MappedFile.get(stream);
+    if (m.pos >= m.data.len) {
+        stream.eof = 1;
+        return 0;
+    }
+    const len = @min(buf.len, m.data.len - m.pos);
+    @memcpy(buf[0..len], m.data[m.pos..][0..len]);
+    m.pos += len;
+    return len;
+}
+
+fn mapWrite(stream: *c.FILE, bytes: []const u8) usize {
+    _ = bytes;
+    stream.errno = c.EBADF;
+    return 0;
+}
+
+fn mapSeek(stream: *c.FILE, offset: i64, whence: c_int) ?i64 {
+    const m = MappedFile.get(stream);
+    const base: i64 = switch (whence) {
+        c.SEEK_SET => 0,
+        c.SEEK_CUR => @intCast(m.pos),
+        c.SEEK_END => @intCast(m.data.len),
+        else => {
+            errno = c.EINVAL;
+            return null;
+        },
+    };
+    const pos = std.math.add(i64, base, offset) catch {
+        errno = c.EINVAL;
+        return null;
+    };
+    if (pos < 0) {
+        errno = c.EINVAL;
+        return null;
+    }
+    m.pos = @intCast(pos);
+    return pos;
+}
+
+fn mapClose(stream: *c.FILE) bool {
+    const m = MappedFile.get(stream);
+    std.os.munmap(m.data);
+    malloc_impl.free(@ptrCast(@alignCast(m)));
+    return closeFd(stream);
+}
+
+fn mapWindow(stream: *c.FILE) []u8 {
+    const m = MappedFile.get(stream);
+    const start = @min(m.pos, m.data.len);
+    m.pos = m.data.len;
+    // the mapping is read-only, ungetc makes sure nothing writes to it
+    return @constCast(m.data[start..]);
+}
+
 export fn freopen(filename: [*:0]const u8, mode: [*:0]const u8, stream: *c.FILE) callconv(.C) *c.FILE {
     _ = filename;
     _ = mode;
@@ -860,40 +1775,85 @@ export fn freopen(filename: [*:0]const u8, mode: [*:0]const u8, stream: *c.FILE)
 
 export fn fclose(stream: *c.FILE) callconv(.C) c_int {
     trace.log("fclose {*}", .{stream});
+    lockStream(stream);
+    const flushed = flushBuffer(stream);
+    freeBuffer(stream);
+    const closed = fileOps(stream).close(stream);
+    unlockStream(stream);
+    global.releaseFile(stream);
+    return if (flushed and closed) 0 else c.EOF;
+}
+
+fn closeFd(stream: *c.FILE) bool {
     if (builtin.os.tag == .windows) {
         std.os.close(stream.fd.?);
     } else {
         std.os.close(stream.fd);
     }
-    global.releaseFile(stream);
-    return 0;
+    return true;
 }
 
 export fn fseek(stream: *c.FILE, offset: c_long, whence: c_int) callconv(.C) c_int {
-    // TODO: update eof when applicable
     trace.log("fseek {*} offset={} whence={}", .{ stream, offset, whence });
+    lockStream(stream);
+    defer unlockStream(stream);
+    return if (seekStream(stream, offset, whence)) 0 else -1;
+}
 
+fn seekFd(stream: *c.FILE, offset: i64, whence: c_int) ?i64 {
     if (builtin.os.tag == .windows) {
-        @panic("fseek not implemented on Windows");
-    }
-
-    // woraround error in std/os/linux.zig: error: destination type 'usize' has size 4 but source type 'i64' has size 8
-    // return syscall3(.lseek, @bitCast(usize, @as(isize, fd)), @bitCast(usize, offset), whence);
-    //                                                                   ^
-    if (@sizeOf(usize) == 4) @panic("not implemented");
-    const rc = std.os.system.lseek(stream.fd, @as(i64, @intCast(offset)), @as(usize, @intCast(whence)));
-    switch (std.os.errno(rc)) {
-        .SUCCESS => return 0,
-        else => |e| {
-            errno = @intFromEnum(e);
-            return -1;
-        },
+        // FILE_BEGIN, FILE_CURRENT and FILE_END match the SEEK_ values
+        var new_offset: std.os.windows.LARGE_INTEGER = undefined;
+        if (0 == std.os.windows.kernel32.SetFilePointerEx(stream.fd.?, offset, &new_offset, @intCast(whence))) {
+            errno = @intFromEnum(std.os.windows.kernel32.GetLastError());
+            return null;
+        }
+        return new_offset;
+    } else if (builtin.os.tag == .linux and @sizeOf(usize) == 4) {
+        // lseek can't take a 64-bit offset on 32-bit targets
+        var new_offset: u64 = undefined;
+        const rc = std.os.linux.llseek(stream.fd, @bitCast(offset), &new_offset, @intCast(whence));
+        switch (std.os.errno(rc)) {
+            .SUCCESS => return @bitCast(new_offset),
+            else => |e| {
+                errno = @intFromEnum(e);
+                return null;
+            },
+        }
+    } else {
+        const rc = std.os.system.lseek(stream.fd, offset, @as(usize, @intCast(whence)));
+        switch (std.os.errno(rc)) {
+            .SUCCESS => return @as(i64, @bitCast(rc)),
+            else => |e| {
+                errno = @intFromEnum(e);
+                return null;
+            },
+        }
     }
 }
 
 export fn ftell(stream: *c.FILE) callconv(.C) c_long {
-    _ = stream;
-    @panic("ftell not implemented");
+    lockStream(stream);
+    defer unlockStream(stream);
+    const pos = streamPosition(stream) orelse return -1;
+    return std.math.cast(c_long, pos) orelse {
+        errno = c.EOVERFLOW;
+        return -1;
+    };
+}
+
+export fn fgetpos(stream: *c.FILE, pos: *c.fpos_t) callconv(.C) c_int {
+    lockStream(stream);
+    defer unlockStream(stream);
+    pos.* = streamPosition(stream) orelse return -1;
+    return 0;
+}
+
+export fn fsetpos(stream: *c.FILE, pos: *const c.fpos_t) callconv(.C) c_int {
+    trace.log("fsetpos {*} pos={}", .{ stream, pos.* });
+    lockStream(stream);
+    defer unlockStream(stream);
+    return if (seekStream(stream, pos.*, c.SEEK_SET)) 0 else -1;
 }
 
 export fn rewind(stream: *c.FILE) callconv(.C) void {
@@ -909,127 +1869,484 @@ export fn rewind(stream: *c.FILE) callconv(.C) void {
 //       so what's the history?
 comptime {
     @export(fputc, .{ .name = "putc" });
+    @export(fputc_unlocked, .{ .name = "putc_unlocked" });
 }
 
 export fn fputc(character: c_int, stream: *c.FILE) callconv(.C) c_int {
+    lockStream(stream);
+    defer unlockStream(stream);
+    return fputc_unlocked(character, stream);
+}
+
+export fn fputc_unlocked(character: c_int, stream: *c.FILE) callconv(.C) c_int {
     trace.log("fputc {} stream={*}", .{ character, stream });
-    if (builtin.os.tag == .windows) {
-        @panic("fputc not implemented");
-    }
-    const buf = [_]u8{@as(u8, @intCast(0xff & character))};
-    const written = std.os.system.write(stream.fd, &buf, 1);
-    switch (std.os.errno(written)) {
-        .SUCCESS => {
-            if (written == 1) return character;
-            stream.errno = @intFromEnum(std.os.E.IO);
-            return c.EOF;
-        },
-        else => |e| {
-            stream.errno = @intFromEnum(e);
-            return c.EOF;
-        },
+    const ch: u8 = @intCast(0xff & character);
+    // fast path, the byte fits in the buffer and doesn't need a flush
+    if (stream.buf != null and stream.buf_len < stream.buf_size and stream.rpos == null and
+        (stream.buf_mode == c._IOFBF or (stream.buf_mode == c._IOLBF and ch != '\n')))
+    {
+        stream.buf[stream.buf_len] = ch;
+        stream.buf_len += 1;
+        return ch;
     }
+    const buf = [_]u8{ch};
+    return if (1 == _fwrite_buf(&buf, 1, stream)) ch else c.EOF;
 }
 
 // NOTE: this is not apart of libc
+// The caller holds the stream lock.
 export fn _fwrite_buf(ptr: [*]const u8, size: usize, stream: *c.FILE) callconv(.C) usize {
+    const bytes = ptr[0..size];
+    if (!prepareWrite(stream)) return writeDirect(stream, bytes);
+    if (bytes.len > stream.buf_size - stream.buf_len) {
+        if (!flushBuffer(stream)) return 0;
+        // no point copying it through the buffer
+        if (bytes.len >= stream.buf_size) return writeDirect(stream, bytes);
+    }
+    @memcpy((stream.buf + stream.buf_len)[0..bytes.len], bytes);
+    stream.buf_len += bytes.len;
+    if (stream.buf_mode == c._IOLBF and std.mem.indexOfScalar(u8, bytes, '\n') != null) {
+        // the bytes are accepted either way, a failed flush shows up in ferror
+        _ = flushBuffer(stream);
+    }
+    return bytes.len;
+}
+
+/// retries short writes
+fn writeFd(stream: *c.FILE, bytes: []const u8) usize {
     if (builtin.os.tag == .windows) {
         var written: usize = undefined;
-        windows.writeAll(stream.fd.?, ptr[0..size], &written) catch {
+        windows.writeAll(stream.fd.?, bytes, &written) catch {
             stream.errno = @intFromEnum(std.os.windows.kernel32.GetLastError());
         };
         return written;
     }
-    const written = std.os.system.write(stream.fd, ptr, size);
-    switch (std.os.errno(written)) {
-        .SUCCESS => {
-            if (written != size) {
-                stream.errno = @intFromEnum(std.os.E.IO);
-            }
-            return written;
-        },
-        else => |e| {
-            stream.errno = @intFromEnum(e);
-            return 0;
-        },
+    var written: usize = 0;
+    while (written < bytes.len) {
+        const rc = std.os.system.write(stream.fd, bytes.ptr + written, bytes.len - written);
+        switch (std.os.errno(rc)) {
+            .SUCCESS => {
+                if (rc == 0) {
+                    stream.errno = @intFromEnum(std.os.E.IO);
+                    break;
+                }
+                written += rc;
+            },
+            .INTR => continue,
+            else => |e| {
+                stream.errno = @intFromEnum(e);
+                break;
+            },
+        }
     }
+    return written;
+}
+
+/// Writes line and a newline, with a single writev if the stream is unbuffered.
+fn writeLine(stream: *c.FILE, line: []const u8) bool {
+    if (!prepareWrite(stream)) return writeLineDirect(stream, line) == line.len + 1;
+    return _fwrite_buf(line.ptr, line.len, stream) == line.len and
+        _fwrite_buf("\n", 1, stream) == 1;
+}
+
+fn writeLineDirect(stream: *c.FILE, line: []const u8) usize {
+    if (builtin.os.tag == .windows or stream.ops != null) {
+        const written = writeDirect(stream, line);
+        if (written != line.len) return written;
+        return written + writeDirect(stream, "\n");
+    }
+    var iovecs = [_]std.os.iovec_const{
+        .{ .iov_base = line.ptr, .iov_len = line.len },
+        .{ .iov_base = "\n", .iov_len = 1 },
+    };
+    var iov: []std.os.iovec_const = &iovecs;
+    var written: usize = 0;
+    while (iov.len > 0) {
+        const rc = std.os.system.writev(stream.fd, iov.ptr, @intCast(iov.len));
+        switch (std.os.errno(rc)) {
+            .SUCCESS => {
+                if (rc == 0) {
+                    stream.errno = @intFromEnum(std.os.E.IO);
+                    break;
+                }
+                var len: usize = @intCast(rc);
+                written += len;
+                advanceOffset(stream, len, true);
+                // a short write can stop partway through either part
+                while (iov.len > 0 and len >= iov[0].iov_len) {
+                    len -= iov[0].iov_len;
+                    iov = iov[1..];
+                }
+                if (iov.len > 0) {
+                    iov[0].iov_base += len;
+                    iov[0].iov_len -= len;
+                }
+            },
+            .INTR => continue,
+            else => |e| {
+                stream.errno = @intFromEnum(e);
+                break;
+            },
+        }
+    }
+    return written;
+}
+
+const FileWriter = std.io.Writer(*c.FILE, error{WriteFailed}, fileWrite);
+fn fileWrite(stream: *c.FILE, bytes: []const u8) error{WriteFailed}!usize {
+    const written = _fwrite_buf(bytes.ptr, bytes.len, stream);
+    if (written == 0 and bytes.len > 0) return error.WriteFailed;
+    return written;
 }
 
 // TODO: can ptr be NULL?
 // TODO: can stream be NULL (I don't think it can)
 export fn fwrite(ptr: [*]const u8, size: usize, nmemb: usize, stream: *c.FILE) callconv(.C) usize {
+    lockStream(stream);
+    defer unlockStream(stream);
+    return fwrite_unlocked(ptr, size, nmemb, stream);
+}
+
+export fn fwrite_unlocked(ptr: [*]const u8, size: usize, nmemb: usize, stream: *c.FILE) callconv(.C) usize {
     trace.log("fwrite {*} size={} n={} stream={*}", .{ ptr, size, nmemb, stream });
-    const total = size * nmemb;
+    const total = std.math.mul(usize, size, nmemb) catch return sizeOverflow(stream);
     const result = _fwrite_buf(ptr, total, stream);
     if (result == total) return nmemb;
     return result / size;
 }
 
 export fn fflush(stream: ?*c.FILE) callconv(.C) c_int {
+    const s = stream orelse return fflush_unlocked(null);
+    lockStream(s);
+    defer unlockStream(s);
+    return fflush_unlocked(s);
+}
+
+export fn fflush_unlocked(stream: ?*c.FILE) callconv(.C) c_int {
     trace.log("fflush {*}", .{stream});
-    return 0; // no-op since there's no buffering right now
+    // flushAll locks each stream
+    const s = stream orelse return flushAll();
+    // for input, put the file offset where the program stopped reading
+    if (s.rpos != s.rend) _ = dropReadBuffer(s);
+    return if (flushBuffer(s)) 0 else c.EOF;
 }
 
 export fn putchar(ch: c_int) callconv(.C) c_int {
     trace.log("putchar {}", .{ch});
-    const buf = [_]u8{@as(u8, @intCast(ch & 0xff))};
-    return if (1 == _fwrite_buf(&buf, 1, stdout)) buf[0] else c.EOF;
+    return fputc(ch, stdout);
+}
+
+export fn putchar_unlocked(ch: c_int) callconv(.C) c_int {
+    return fputc_unlocked(ch, stdout);
 }
 
 export fn puts(s: [*:0]const u8) callconv(.C) c_int {
     trace.log("puts {}", .{trace.fmtStr(s)});
-    return fputs(s, stdout);
+    lockStream(stdout);
+    defer unlockStream(stdout);
+    return if (writeLine(stdout, std.mem.span(s))) 1 else c.EOF;
 }
 
 export fn fputs(s: [*:0]const u8, stream: *c.FILE) callconv(.C) c_int {
+    lockStream(stream);
+    defer unlockStream(stream);
+    return fputs_unlocked(s, stream);
+}
+
+export fn fputs_unlocked(s: [*:0]const u8, stream: *c.FILE) callconv(.C) c_int {
     trace.log("fputs {} stream={*}", .{ trace.fmtStr(s), stream });
-    // NOTE: this is inneficient
-    //       Maybe I could do a writev?
-    //       Or maybe I could make 2 write calls with a locking mechanism?
     const len = std.mem.len(s);
-    // TODO: maybe use malloc?
-    const mem = std.heap.page_allocator.alloc(u8, len + 1) catch |err| switch (err) {
-        error.OutOfMemory => {
-            // maybe fallback to 2 writes?
-            @panic("here");
-        },
-    };
-    defer std.heap.page_allocator.free(mem);
-    @memcpy(mem, s);
-    mem[len] = '\n';
-
-    const written = _fwrite_buf(mem.ptr, mem.len, stream);
-    return if (written == 0) c.EOF else 1;
+    return if (_fwrite_buf(s, len, stream) == len) 1 else c.EOF;
 }
 
 export fn fgets(s: [*]u8, n: c_int, stream: *c.FILE) callconv(.C) ?[*]u8 {
-    if (stream.eof != 0) return null;
+    lockStream(stream);
+    defer unlockStream(stream);
+    return fgets_unlocked(s, n, stream);
+}
 
-    // TODO: this implementation is very slow/inefficient
+export fn fgets_unlocked(s: [*]u8, n: c_int, stream: *c.FILE) callconv(.C) ?[*]u8 {
+    if (n <= 0) return null;
+    const limit: usize = @intCast(n - 1);
     var total_read: usize = 0;
-    while (true) : (total_read += 1) {
-        if (total_read + 1 >= n) {
-            s[total_read] = 0;
-            return s;
-        }
-        stream.errno = 0;
-        const result = getc(stream);
-        if (result == c.EOF) {
-            if (stream.errno == 0) {
-                stream.eof = 1;
-                if (total_read > 0) {
-                    s[total_read] = 0;
-                    return s;
-                }
+    while (total_read < limit) {
+        if (stream.rpos == stream.rend) {
+            if (stream.eof != 0 or !fillReadBuffer(stream)) {
+                if (total_read == 0) return null;
+                break;
             }
-            return null;
         }
-        s[total_read] = @as(u8, @intCast(result));
-        if (s[total_read] == '\n') {
-            s[total_read + 1] = 0;
-            return s;
+        const input = bufferedInput(stream);
+        const max = @min(input.len, limit - total_read);
+        const len = if (memchr(input.ptr, '\n', max)) |newline|
+            @intFromPtr(newline) - @intFromPtr(input.ptr) + 1
+        else
+            max;
+        @memcpy(s[total_read..][0..len], input[0..len]);
+        total_read += len;
+        stream.rpos += len;
+        if (s[total_read - 1] == '\n') break;
+    }
+    s[total_read] = 0;
+    return s;
+}
+
+/// The state behind fmemopen, open_memstream and open_wmemstream streams,
+/// in FILE.cookie.  They are unbuffered so writes land in the memory right
+/// away, and the printf engine writes straight into it.
+const MemStream = struct {
+    data: [*]u8,
+    /// in chars, fixed for fmemopen and grown by the others
+    capacity: usize,
+    /// chars of content, reads stop here
+    len: usize = 0,
+    pos: usize = 0,
+    /// @sizeOf(c.wchar_t) for open_wmemstream, which widens every byte
+    /// written to one wide char
+    char_size: usize = 1,
+    can_read: bool = false,
+    can_write: bool = false,
+    append: bool = false,
+    /// fmemopen(NULL, ...) allocates the memory
+    own_data: bool = false,
+    /// where open_memstream and open_wmemstream publish the memory and size
+    user_data: ?*?[*]u8 = null,
+    user_size: ?*usize = null,
+
+    fn get(stream: *c.FILE) *MemStream {
+        return @ptrCast(@alignCast(stream.cookie.?));
+    }
+
+    fn growable(self: *const MemStream) bool {
+        return self.user_data != null;
+    }
+
+    /// Makes room for at least chars chars, doubling the capacity
+    fn reserve(self: *MemStream, chars: usize) bool {
+        if (chars <= self.capacity) return true;
+        var new_capacity = self.capacity * 2;
+        if (new_capacity < chars) new_capacity = chars;
+        const new_size = std.math.mul(usize, new_capacity, self.char_size) catch return false;
+        self.data = malloc_impl.realloc(@alignCast(self.data), new_size) orelse return false;
+        self.capacity = new_capacity;
+        return true;
+    }
+
+    fn setChars(self: *MemStream, start: usize, bytes: []const u8) void {
+        if (self.char_size == 1) {
+            @memcpy(self.data[start..][0..bytes.len], bytes);
+            return;
+        }
+        const wide: [*]c.wchar_t = @ptrCast(@alignCast(self.data));
+        for (wide[start..][0..bytes.len], bytes) |*dst, b| dst.* = b;
+    }
+
+    fn clearChars(self: *MemStream, start: usize, count: usize) void {
+        @memset(self.data[start * self.char_size ..][0 .. count * self.char_size], 0);
+    }
+
+    fn publish(self: *MemStream) void {
+        if (self.user_data) |user_data| {
+            user_data.* = self.data;
+            self.user_size.?.* = @min(self.pos, self.len);
         }
     }
+};
+
+const mem_ops = FileOps{ .read = memRead, .write = memWrite, .seek = memSeek, .close = memClose };
+
+/// For streams that can read, which are all fmemopen byte streams, so
+/// reads come straight from the memory
+const mem_window_ops = FileOps{
+    .read = memRead,
+    .write = memWrite,
+    .seek = memSeek,
+    .close = memClose,
+    .window = memWindow,
+};
+
+fn memRead(stream: *c.FILE, buf: []u8) usize {
+    const m = MemStream.get(stream);
+    if (!m.can_read) {
+        stream.errno = c.EBADF;
+        return 0;
+    }
+    if (m.pos >= m.len) {
+        stream.eof = 1;
+        return 0;
+    }
+    const len = @min(buf.len, m.len - m.pos);
+    @memcpy(buf[0..len], m.data[m.pos..][0..len]);
+    m.pos += len;
+    return len;
+}
+
+fn memWindow(stream: *c.FILE) []u8 {
+    const m = MemStream.get(stream);
+    std.debug.assert(m.char_size == 1);
+    const start = @min(m.pos, m.len);
+    m.pos = @max(m.pos, m.len);
+    // fmemopen memory never moves, ungetc makes sure nothing writes to it
+    // and writes drop the read buffer first
+    return m.data[start * m.char_size .. m.len * m.char_size];
+}
+
+fn memWrite(stream: *c.FILE, bytes: []const u8) usize {
+    const m = MemStream.get(stream);
+    if (!m.can_write) {
+        stream.errno = c.EBADF;
+        return 0;
+    }
+    if (m.append) m.pos = m.len;
+    // growable streams keep a 0 after the content
+    if (m.growable() and !m.reserve(m.pos + bytes.len + 1)) {
+        stream.errno = c.ENOMEM;
+        return 0;
+    }
+    // a seek past the end leaves a gap of zeros
+    if (m.pos > m.len) m.clearChars(m.len, m.pos - m.len);
+    const len = @min(bytes.len, m.capacity - m.pos);
+    m.setChars(m.pos, bytes[0..len]);
+    m.pos += len;
+    if (m.pos > m.len) {
+        m.len = m.pos;
+        if (m.len < m.capacity) m.clearChars(m.len, 1);
+    }
+    m.publish();
+    if (len < bytes.len) stream.errno = c.ENOSPC;
+    return len;
+}
+
+fn memSeek(stream: *c.FILE, offset: i64, whence: c_int) ?i64 {
+    const m = MemStream.get(stream);
+    const base: i64 = switch (whence) {
+        c.SEEK_SET => 0,
+        c.SEEK_CUR => @intCast(m.pos),
+        c.SEEK_END => @intCast(m.len),
+        else => {
+            errno = c.EINVAL;
+            return null;
+        },
+    };
+    const pos = std.math.add(i64, base, offset) catch {
+        errno = c.EINVAL;
+        return null;
+    };
+    if (pos < 0 or (!m.growable() and pos > m.capacity)) {
+        errno = c.EINVAL;
+        return null;
+    }
+    m.pos = @intCast(pos);
+    m.publish();
+    return pos;
+}
+
+fn memClose(stream: *c.FILE) bool {
+    const m = MemStream.get(stream);
+    m.publish();
+    if (m.own_data) malloc_impl.free(@alignCast(m.data));
+    malloc_impl.free(@ptrCast(@alignCast(m)));
+    return true;
+}
+
+/// Sets up a stream that's been reserved for the MemStream in m
+fn openMem(m: MemStream) ?*c.FILE {
+    const cookie: *MemStream = @ptrCast(malloc_impl.alloc(@sizeOf(MemStream)) orelse {
+        errno = c.ENOMEM;
+        return null;
+    });
+    const file = global.reserveFile() orelse {
+        malloc_impl.free(@ptrCast(@alignCast(cookie)));
+        errno = c.ENOMEM;
+        return null;
+    };
+    cookie.* = m;
+    cookie.publish();
+    file.fd = if (builtin.os.tag == .windows) null else -1;
+    file.ops = if (m.can_read) &mem_window_ops else &mem_ops;
+    file.cookie = cookie;
+    file.buf_mode = c._IONBF;
+    if (m.append) file.flags |= file_flag.append;
+    return file;
+}
+
+export fn fmemopen(buf: ?[*]u8, size: usize, mode: [*:0]const u8) callconv(.C) ?*c.FILE {
+    trace.log("fmemopen {*} size={} mode={}", .{ buf, size, trace.fmtStr(mode) });
+    if (size == 0) {
+        errno = c.EINVAL;
+        return null;
+    }
+    var m = MemStream{ .data = undefined, .capacity = size };
+    const update = std.mem.indexOfScalar(u8, std.mem.span(mode), '+') != null;
+    switch (mode[0]) {
+        'r' => {
+            m.can_read = true;
+            m.can_write = update;
+        },
+        'w' => {
+            m.can_read = update;
+            m.can_write = true;
+        },
+        'a' => {
+            m.can_read = update;
+            m.can_write = true;
+            m.append = true;
+        },
+        else => {
+            errno = c.EINVAL;
+            return null;
+        },
+    }
+    if (buf) |b| {
+        m.data = b;
+    } else {
+        m.data = malloc_impl.allocZeroed(size) orelse {
+            errno = c.ENOMEM;
+            return null;
+        };
+        m.own_data = true;
+    }
+    switch (mode[0]) {
+        'r' => m.len = size,
+        'w' => m.data[0] = 0,
+        else => {
+            m.len = std.mem.indexOfScalar(u8, m.data[0..size], 0) orelse size;
+            m.pos = m.len;
+        },
+    }
+    return openMem(m) orelse {
+        if (m.own_data) malloc_impl.free(@alignCast(m.data));
+        return null;
+    };
+}
+
+export fn open_memstream(bufp: *?[*]u8, sizep: *usize) callconv(.C) ?*c.FILE {
+    trace.log("open_memstream", .{});
+    return openGrowable(bufp, sizep, 1);
+}
+
+export fn open_wmemstream(bufp: *?[*]c.wchar_t, sizep: *usize) callconv(.C) ?*c.FILE {
+    trace.log("open_wmemstream", .{});
+    return openGrowable(@ptrCast(bufp), sizep, @sizeOf(c.wchar_t));
+}
+
+fn openGrowable(bufp: *?[*]u8, sizep: *usize, char_size: usize) ?*c.FILE {
+    const initial_capacity = 64;
+    const m = MemStream{
+        .data = malloc_impl.allocZeroed(initial_capacity * char_size) orelse {
+            errno = c.ENOMEM;
+            return null;
+        },
+        .capacity = initial_capacity,
+        .char_size = char_size,
+        .can_write = true,
+        .user_data = bufp,
+        .user_size = sizep,
+    };
+    return openMem(m) orelse {
+        malloc_impl.free(@alignCast(m.data));
+        return null;
+    };
 }
 
 export fn tmpfile() callconv(.C) *c.FILE {
@@ -1043,15 +2360,43 @@ export fn tmpnam(s: [*]u8) callconv(.C) [*]u8 {
 
 export fn clearerr(stream: *c.FILE) callconv(.C) void {
     trace.log("clearerr {*}", .{stream});
+    lockStream(stream);
+    defer unlockStream(stream);
     stream.errno = 0;
+    stream.eof = 0;
 }
 
 export fn setvbuf(stream: *c.FILE, buf: ?[*]u8, mode: c_int, size: usize) callconv(.C) c_int {
-    _ = stream;
-    _ = buf;
-    _ = mode;
-    _ = size;
-    @panic("setvbuf not implemented");
+    trace.log("setvbuf {*} buf={*} mode={} size={}", .{ stream, buf, mode, size });
+    switch (mode) {
+        c._IOFBF, c._IOLBF, c._IONBF => {},
+        else => {
+            errno = c.EINVAL;
+            return -1;
+        },
+    }
+    lockStream(stream);
+    defer unlockStream(stream);
+    // C only allows setvbuf before any I/O, be forgiving and flush what's pending
+    if (!flushBuffer(stream)) return -1;
+    freeBuffer(stream);
+    stream.flags &= ~@as(c_int, file_flag.detect_mode);
+    stream.buf_mode = mode;
+    if (mode == c._IONBF) return 0;
+    if (buf) |b| {
+        if (size > 0) {
+            stream.buf = b;
+            stream.buf_size = size;
+        }
+    } else {
+        // allocated on first write
+        stream.buf_size = size;
+    }
+    return 0;
+}
+
+export fn setbuf(stream: *c.FILE, buf: ?[*]u8) callconv(.C) void {
+    _ = setvbuf(stream, buf, if (buf == null) c._IONBF else c._IOFBF, c.BUFSIZ);
 }
 
 export fn ferror(stream: *c.FILE) callconv(.C) c_int {
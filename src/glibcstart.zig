@@ -5,6 +5,8 @@ const std = @import("std");
 
 const c = struct {
     extern fn main(argc: c_int, argv: [*:null]?[*:0]u8) callconv(.C) c_int;
+    extern fn exit(status: c_int) callconv(.C) noreturn;
+    extern fn __zinit() callconv(.C) void;
 };
 
 export fn __libc_csu_init(
@@ -37,19 +39,52 @@ export fn __libc_start_main(
     _ = fini;
     _ = rtld_fini;
     _ = stack_end;
-    std.log.warn("__libc_start_main is probably not doing everything it needs too", .{});
     // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
     // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-    // TODO: pass envp
+    // TODO: pass envp to main
     // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
     // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+    // the environment comes right after argv, std.os.getenv needs it
+    const envp: [*:null]?[*:0]u8 = @ptrCast(argv + @as(usize, @intCast(argc)) + 1);
+    std.os.environ = @as([*][*:0]u8, @ptrCast(envp))[0..std.mem.len(envp)];
+    if (builtin.os.tag == .linux) initTls(envp);
+    std.log.warn("__libc_start_main is probably not doing everything it needs too", .{});
+    c.__zinit();
     var result = c.main(argc, argv);
     if (result != 0) {
         while ((result & 0xff == 0)) result = result >> 8;
     }
-    std.os.exit(@as(u8, @intCast(result & 0xff)));
+    c.exit(result & 0xff);
+}
+
+/// glibc sets up thread local storage in its __libc_start_main, so it's up
+/// to us when our library replaces it (malloc keeps its heap in a threadlocal).
+/// This is what the zig start code does.  An executable with a dynamic
+/// loader already has it set up by the loader.
+fn initTls(envp: [*:null]?[*:0]u8) void {
+    const elf = std.elf;
+    // the auxiliary vector comes right after the environment
+    const auxv: [*]elf.Auxv = @ptrCast(@alignCast(envp + std.mem.len(envp) + 1));
+    std.os.linux.elf_aux_maybe = auxv;
+    var at_phdr: usize = 0;
+    var at_phnum: usize = 0;
+    var i: usize = 0;
+    while (auxv[i].a_type != elf.AT_NULL) : (i += 1) {
+        switch (auxv[i].a_type) {
+            elf.AT_PHDR => at_phdr = auxv[i].a_un.a_val,
+            elf.AT_PHNUM => at_phnum = auxv[i].a_un.a_val,
+            else => {},
+        }
+    }
+    const phdrs = @as([*]elf.Phdr, @ptrFromInt(at_phdr))[0..at_phnum];
+    for (phdrs) |phdr| {
+        if (phdr.p_type == elf.PT_INTERP) return;
+    }
+    std.os.linux.tls.initStaticTLS(phdrs);
 }
 
+// Only reached for TLS in a module loaded at runtime, the executable's own
+// TLS is set up by initTls and accessed without it.
 export fn __tls_get_addr(ptr: *usize) callconv(.C) *anyopaque {
     std.debug.panic("__tls_get_addr (ptr={*}) is not implemented", .{ptr});
 }
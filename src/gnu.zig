@@ -1,5 +1,8 @@
+const std = @import("std");
+
 const c = @cImport({
     @cInclude("argp.h");
+    @cInclude("obstack.h");
 });
 
 export fn argp_usage(state: *const c.argp_state) callconv(.C) void {
@@ -23,3 +26,130 @@ export fn argp_parse(
     _ = input;
     @panic("argp_parse not impl");
 }
+
+// --------------------------------------------------------------------------------
+// obstack
+// --------------------------------------------------------------------------------
+const Obstack = c.struct_obstack;
+const ObstackChunk = c.struct__obstack_chunk;
+
+/// same as glibc, a 4 KiB block minus malloc overhead
+const obstack_default_chunk_size = 4064;
+const obstack_default_align = 16;
+
+fn obstackDefaultAllocFailed() callconv(.C) void {
+    _ = std.os.write(2, "memory exhausted\n") catch {};
+    std.os.exit(1);
+}
+export var obstack_alloc_failed_handler: ?*const fn () callconv(.C) void = &obstackDefaultAllocFailed;
+
+fn obstackAllocFailed() noreturn {
+    if (obstack_alloc_failed_handler) |handler| handler();
+    // the handler isn't supposed to return
+    obstackDefaultAllocFailed();
+    unreachable;
+}
+
+/// the first aligned address after the chunk header
+fn obstackContents(h: *Obstack, chunk: *ObstackChunk) [*]u8 {
+    const start = @intFromPtr(chunk) + @sizeOf(ObstackChunk);
+    return @ptrFromInt((start + h.alignment_mask) & ~h.alignment_mask);
+}
+
+fn obstackAllocChunk(h: *Obstack, size: usize) *ObstackChunk {
+    const mem = h.chunkfun.?(size) orelse obstackAllocFailed();
+    const chunk: *ObstackChunk = @ptrCast(@alignCast(mem));
+    chunk.limit = @as([*]u8, @ptrCast(mem)) + size;
+    return chunk;
+}
+
+export fn _obstack_begin(
+    h: *Obstack,
+    size: usize,
+    alignment: usize,
+    chunkfun: ?*const fn (usize) callconv(.C) ?*anyopaque,
+    freefun: ?*const fn (?*anyopaque) callconv(.C) void,
+) callconv(.C) c_int {
+    h.alignment_mask = (if (alignment == 0) obstack_default_align else alignment) - 1;
+    // the first object has to fit after the header
+    h.chunk_size = @max(
+        if (size == 0) obstack_default_chunk_size else size,
+        @sizeOf(ObstackChunk) + h.alignment_mask + 1,
+    );
+    h.chunkfun = chunkfun;
+    h.freefun = freefun;
+    h.maybe_empty_object = 0;
+    const chunk = obstackAllocChunk(h, h.chunk_size);
+    chunk.prev = null;
+    h.chunk = chunk;
+    h.object_base = obstackContents(h, chunk);
+    h.next_free = h.object_base;
+    h.chunk_limit = chunk.limit;
+    return 1;
+}
+
+/// Moves the object being built to a new chunk with room for length more bytes
+export fn _obstack_newchunk(h: *Obstack, length: usize) callconv(.C) void {
+    const old_chunk: *ObstackChunk = h.chunk;
+    const obj_size = @intFromPtr(h.next_free) - @intFromPtr(h.object_base);
+    // leave some extra room so an object that grows a byte at a time isn't copied every time
+    const extra = (obj_size >> 3) + h.alignment_mask + @sizeOf(ObstackChunk) + 100;
+    const new_size = @max(h.chunk_size, std.math.add(usize, obj_size + extra, length) catch obstackAllocFailed());
+    const new_chunk = obstackAllocChunk(h, new_size);
+    new_chunk.prev = old_chunk;
+    const new_base = obstackContents(h, new_chunk);
+    @memcpy(new_base[0..obj_size], h.object_base[0..obj_size]);
+
+    // if the object was the only thing in the old chunk, the chunk isn't needed anymore
+    if (h.maybe_empty_object == 0 and @intFromPtr(h.object_base) == @intFromPtr(obstackContents(h, old_chunk))) {
+        new_chunk.prev = old_chunk.prev;
+        h.freefun.?(old_chunk);
+    }
+    h.chunk = new_chunk;
+    h.object_base = new_base;
+    h.next_free = new_base + obj_size;
+    h.chunk_limit = new_chunk.limit;
+    h.maybe_empty_object = 0;
+}
+
+export fn _obstack_allocated_p(h: *Obstack, obj: ?*anyopaque) callconv(.C) c_int {
+    const addr = @intFromPtr(obj orelse return 0);
+    var next: ?*ObstackChunk = h.chunk;
+    while (next) |chunk| : (next = chunk.prev) {
+        if (addr > @intFromPtr(chunk) and addr <= @intFromPtr(chunk.limit)) return 1;
+    }
+    return 0;
+}
+
+export fn _obstack_memory_used(h: *Obstack) callconv(.C) usize {
+    var total: usize = 0;
+    var next: ?*ObstackChunk = h.chunk;
+    while (next) |chunk| : (next = chunk.prev) {
+        total += @intFromPtr(chunk.limit) - @intFromPtr(chunk);
+    }
+    return total;
+}
+
+/// Frees obj and everything allocated after it, every chunk when obj is NULL
+export fn obstack_free(h: *Obstack, obj: ?*anyopaque) callconv(.C) void {
+    const addr = if (obj) |o| @intFromPtr(o) else 0;
+    var next: ?*ObstackChunk = h.chunk;
+    while (next) |chunk| {
+        if (addr > @intFromPtr(chunk) and addr <= @intFromPtr(chunk.limit)) {
+            h.chunk = chunk;
+            h.object_base = @ptrCast(obj.?);
+            h.next_free = h.object_base;
+            h.chunk_limit = chunk.limit;
+            return;
+        }
+        next = chunk.prev;
+        h.freefun.?(chunk);
+        // the chunk we end up in may start with an empty object
+        h.maybe_empty_object = 1;
+    }
+    if (obj != null) @panic("obstack_free: object is not in the obstack");
+    h.chunk = null;
+    h.object_base = null;
+    h.next_free = null;
+    h.chunk_limit = null;
+}
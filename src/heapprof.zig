@@ -0,0 +1,154 @@
+//! A sampling heap profiler.
+//!
+//! Set ZIGLIBC_HEAP_PROFILE to a file path to enable it.  About once every
+//! ZIGLIBC_HEAP_PROFILE_RATE bytes allocated (512 KiB by default), the stack
+//! of the allocation is recorded.  When the program calls exit, the samples
+//! are written to the file as folded stacks, one "addr;addr;...;addr bytes"
+//! line per stack with the outermost frame first.  The addresses are return
+//! addresses, symbolize them (i.e. with addr2line) before feeding the file to
+//! flamegraph.pl or speedscope.
+//!
+//! Stacks are walked through frame pointers, code built without them gives
+//! short stacks.  Frees aren't tracked, the profile shows where memory is
+//! allocated, not what's still live.
+const builtin = @import("builtin");
+const std = @import("std");
+
+const default_rate = 512 * 1024;
+const max_depth = 32;
+/// maximum number of distinct stacks, a power of 2
+const table_len = 4096;
+
+const State = enum(u8) { uninitialized, disabled, enabled };
+var state = State.uninitialized;
+var rate: usize = default_rate;
+var path: []const u8 = undefined;
+
+/// bytes this thread can allocate before the next sample
+threadlocal var countdown: usize = 0;
+threadlocal var thread_started = false;
+
+const Stack = struct {
+    hash: u64 = 0,
+    depth: u8 = 0,
+    frames: [max_depth]usize = undefined,
+    bytes: usize = 0,
+};
+/// mapped when the profiler is enabled, guarded by mutex
+var stacks: *[table_len]Stack = undefined;
+var stack_count: usize = 0;
+/// bytes of samples that didn't fit in the table
+var dropped_bytes: usize = 0;
+var mutex = std.Thread.Mutex{};
+
+/// Called for every allocation.  first_address is the return address of
+/// the libc function so the stack starts at its caller.
+pub inline fn onAlloc(size: usize, first_address: usize) void {
+    if (@atomicLoad(State, &state, .Monotonic) == .disabled) return;
+    if (size < countdown) {
+        countdown -= size;
+        return;
+    }
+    sample(size, first_address);
+}
+
+fn sample(size: usize, first_address: usize) void {
+    if (@atomicLoad(State, &state, .Acquire) == .uninitialized) init();
+    if (@atomicLoad(State, &state, .Acquire) != .enabled) return;
+    if (!thread_started) {
+        thread_started = true;
+        countdown = rate;
+        if (size < countdown) {
+            countdown -= size;
+            return;
+        }
+    }
+
+    // every sample stands for rate bytes, a large allocation can cover
+    // more than one sample point
+    const past = size - countdown;
+    const bytes = (past / rate + 1) * rate;
+    countdown = rate - past % rate;
+
+    var frames: [max_depth]usize = undefined;
+    var depth: usize = 0;
+    var it = std.debug.StackIterator.init(first_address, null);
+    while (depth < max_depth) : (depth += 1) {
+        frames[depth] = it.next() orelse break;
+    }
+    record(frames[0..depth], bytes);
+}
+
+fn init() void {
+    mutex.lock();
+    defer mutex.unlock();
+    if (state != .uninitialized) return;
+    const new_state: State = blk: {
+        path = getenv("ZIGLIBC_HEAP_PROFILE") orelse break :blk .disabled;
+        if (getenv("ZIGLIBC_HEAP_PROFILE_RATE")) |s| {
+            rate = std.fmt.parseInt(usize, s, 10) catch default_rate;
+            if (rate == 0) rate = default_rate;
+        }
+        stacks = std.heap.page_allocator.create([table_len]Stack) catch break :blk .disabled;
+        stacks.* = [_]Stack{.{}} ** table_len;
+        break :blk .enabled;
+    };
+    @atomicStore(State, &state, new_state, .Release);
+}
+
+fn getenv(name: []const u8) ?[]const u8 {
+    return if (builtin.os.tag == .windows) null else std.os.getenv(name);
+}
+
+fn record(frames: []const usize, bytes: usize) void {
+    const hash = std.hash.Wyhash.hash(0, std.mem.sliceAsBytes(frames));
+    mutex.lock();
+    defer mutex.unlock();
+    var i = @as(usize, @truncate(hash)) & (table_len - 1);
+    while (true) : (i = (i + 1) & (table_len - 1)) {
+        const stack = &stacks[i];
+        if (stack.bytes == 0) {
+            // keep some room so probing stays short
+            if (stack_count >= table_len / 4 * 3) {
+                dropped_bytes += bytes;
+                return;
+            }
+            stack_count += 1;
+            stack.hash = hash;
+            stack.depth = @intCast(frames.len);
+            @memcpy(stack.frames[0..frames.len], frames);
+            stack.bytes = bytes;
+            return;
+        }
+        if (stack.hash == hash and std.mem.eql(usize, stack.frames[0..stack.depth], frames)) {
+            stack.bytes += bytes;
+            return;
+        }
+    }
+}
+
+/// Writes the profile if the profiler is enabled, called from exit
+pub fn dump() void {
+    if (@atomicLoad(State, &state, .Acquire) != .enabled) return;
+    mutex.lock();
+    defer mutex.unlock();
+    const file = std.fs.cwd().createFile(path, .{}) catch return;
+    defer file.close();
+    var buffered = std.io.bufferedWriter(file.writer());
+    dumpTo(buffered.writer()) catch return;
+    buffered.flush() catch return;
+}
+
+fn dumpTo(writer: anytype) !void {
+    for (stacks) |*stack| {
+        if (stack.bytes == 0) continue;
+        if (stack.depth == 0) try writer.writeAll("[unknown]");
+        var i: usize = stack.depth;
+        while (i > 0) : (i -= 1) {
+            try writer.print("0x{x}", .{stack.frames[i - 1]});
+            if (i > 1) try writer.writeByte(';');
+        }
+        try writer.print(" {d}\n", .{stack.bytes});
+    }
+    if (dropped_bytes > 0) try writer.print("[dropped] {d}\n", .{dropped_bytes});
+}
@@ -0,0 +1,1134 @@
+//! The heap behind malloc/free.
+//!
+//! The "fast" backend is a size-class allocator.  Memory is requested from the
+//! OS in segments that are aligned to their size, so the metadata for any block
+//! can be found by masking the block address.  This means blocks don't need a
+//! header.  Each segment is split into pages and each page holds blocks of a
+//! single size class.  Allocations too large for the size classes get a
+//! dedicated segment of their own.
+//!
+//! The "debug" backend is the old GeneralPurposeAllocator based implementation.
+//! It's much slower but can catch double frees and leaks.
+//!
+//! The "bump" backend hands out memory from large chunks and never reuses
+//! it, which is the fastest option for programs that don't run for long.
+//!
+//! The backend is selected with the malloc build option.
+const builtin = @import("builtin");
+const std = @import("std");
+const malloc_options = @import("malloc_options");
+
+pub const Backend = enum {
+    fast,
+    debug,
+    bump,
+};
+pub const backend = @field(Backend, @tagName(malloc_options.backend));
+
+/// alloc_align is the maximum alignment needed for all types
+/// since malloc is not type aware, it just aligns every allocation
+/// to accomodate the maximum possible alignment that could be needed.
+///
+/// TODO: this should probably be in the zig std library somewhere.
+pub const alloc_align = 16;
+
+const impl = switch (backend) {
+    .fast => fast,
+    .debug => debug,
+    .bump => bump,
+};
+
+pub fn alloc(size: usize) ?[*]align(alloc_align) u8 {
+    return impl.alloc(size);
+}
+
+/// Returns a block aligned to alignment, which must be a power of 2.  The
+/// block is freed with free like any other block.
+pub fn allocAligned(size: usize, alignment: usize) ?[*]align(alloc_align) u8 {
+    std.debug.assert(@popCount(alignment) == 1);
+    if (alignment <= alloc_align) return alloc(size);
+    return impl.allocAligned(size, alignment);
+}
+
+/// Like alloc but the block is zero-initialized
+pub fn allocZeroed(size: usize) ?[*]align(alloc_align) u8 {
+    return impl.allocZeroed(size);
+}
+
+pub fn free(ptr: [*]align(alloc_align) u8) void {
+    impl.free(ptr);
+}
+
+/// Returns the number of bytes that can be used at ptr, always >= the requested size
+pub fn usableSize(ptr: [*]align(alloc_align) u8) usize {
+    return impl.usableSize(ptr);
+}
+
+pub fn realloc(ptr: [*]align(alloc_align) u8, size: usize) ?[*]align(alloc_align) u8 {
+    return impl.realloc(ptr, size);
+}
+
+pub const class_count = fast.class_count;
+
+pub const ClassStats = struct {
+    block_size: usize = 0,
+    pages: usize = 0,
+    /// number of blocks that fit in those pages
+    capacity: usize = 0,
+    /// number of blocks handed out
+    used: usize = 0,
+};
+
+/// A snapshot of the heap.  The counters of other threads are read without
+/// synchronizing with them so the numbers are approximate while they run.
+pub const Stats = struct {
+    /// bytes mapped for segments that hold size class pages
+    segment_bytes: usize = 0,
+    /// bytes handed out from those segments
+    in_use: usize = 0,
+    /// bytes in empty segments kept around for reuse
+    cached_bytes: usize = 0,
+    /// blocks too large for the size classes, each has its own mapping
+    huge_count: usize = 0,
+    huge_bytes: usize = 0,
+    /// bytes advised to be backed by transparent huge pages
+    huge_page_bytes: usize = 0,
+    classes: [class_count]ClassStats = [_]ClassStats{.{}} ** class_count,
+
+    /// number of size class blocks that are ready to be handed out
+    pub fn freeBlocks(self: Stats) usize {
+        var total: usize = 0;
+        for (self.classes) |class| total += class.capacity -| class.used;
+        return total;
+    }
+};
+
+pub fn stats() Stats {
+    return impl.stats();
+}
+
+/// Called by the libc's own thread start code when a thread is about to exit.
+/// Anything the thread allocates after that comes from a shared heap.
+/// Threads started without pthread_create never call it and keep their heap.
+pub fn threadExit() void {
+    impl.threadExit();
+}
+
+/// Gives memory that the calling thread's heap isn't using back to the OS.
+/// Returns true if anything was released.
+pub fn trim() bool {
+    return impl.trim();
+}
+
+/// realloc for blocks that can't be resized in place
+fn reallocCopy(ptr: [*]align(alloc_align) u8, size: usize) ?[*]align(alloc_align) u8 {
+    const old_size = usableSize(ptr);
+    // don't bother moving the block if the new size fits and we wouldn't
+    // be wasting more than half of it
+    if (size <= old_size and size >= old_size / 2) return ptr;
+    const new_ptr = alloc(size) orelse return null;
+    @memcpy(new_ptr[0..@min(size, old_size)], ptr);
+    free(ptr);
+    return new_ptr;
+}
+
+/// A std.mem.Allocator on top of malloc for ziglibc's own bookkeeping.
+pub const allocator = std.mem.Allocator{
+    .ptr = undefined,
+    .vtable = &allocator_vtable,
+};
+const allocator_vtable = std.mem.Allocator.VTable{
+    .alloc = allocatorAlloc,
+    .resize = allocatorResize,
+    .free = allocatorFree,
+};
+fn allocatorAlloc(ctx: *anyopaque, len: usize, log2_align: u8, ret_addr: usize) ?[*]u8 {
+    _ = ctx;
+    _ = ret_addr;
+    return allocAligned(len, @as(usize, 1) << @intCast(log2_align));
+}
+fn allocatorResize(ctx: *anyopaque, buf: []u8, log2_align: u8, new_len: usize, ret_addr: usize) bool {
+    _ = ctx;
+    _ = log2_align;
+    _ = ret_addr;
+    return new_len <= usableSize(@alignCast(buf.ptr));
+}
+fn allocatorFree(ctx: *anyopaque, buf: []u8, log2_align: u8, ret_addr: usize) void {
+    _ = ctx;
+    _ = log2_align;
+    _ = ret_addr;
+    free(@alignCast(buf.ptr));
+}
+
+// --------------------------------------------------------------------------------
+// fast backend
+// --------------------------------------------------------------------------------
+const fast = struct {
+    const segment_size = 4 * 1024 * 1024;
+    /// the first segment_info_size bytes of every segment hold the Segment header
+    const segment_info_size = 64 * 1024;
+
+    const small_page_shift = 16; // 64 KiB
+    const medium_page_shift = 19; // 512 KiB
+    const max_page_count = segment_size >> small_page_shift;
+
+    /// largest block that goes in a small page
+    const small_max = 8 * 1024;
+    /// largest block that goes in a medium page
+    const medium_max = 128 * 1024;
+    /// Anything bigger than this gets its own segment mapped straight from the OS
+    /// which is unmapped as soon as it's freed.  On linux, realloc moves these
+    /// with mremap instead of copying them.
+    /// TODO: make this a tunable like M_MMAP_THRESHOLD?
+    const mmap_threshold = medium_max;
+
+    /// Every page starts at a multiple of this, so the blocks of a size class
+    /// are aligned to any power of 2 up to this that divides the class size.
+    const max_class_align = segment_info_size;
+
+    comptime {
+        std.debug.assert(@sizeOf(Segment) <= segment_info_size);
+        std.debug.assert(class_sizes[class_count - 1] == medium_max);
+    }
+
+    // Size classes go up by 16 bytes until 128, after that there are 4
+    // classes for every power of 2 so no more than 25% of a block is wasted.
+    const class_count = sizeClass(medium_max) + 1;
+    const class_sizes = blk: {
+        var sizes: [class_count]u32 = undefined;
+        for (&sizes, 0..) |*size, i| {
+            if (i < 8) {
+                size.* = @intCast((i + 1) * 16);
+            } else {
+                const shift: u5 = @intCast(7 + (i - 8) / 4);
+                const step = @as(u32, 1) << (shift - 2);
+                size.* = (@as(u32, 1) << shift) + @as(u32, @intCast((i - 8) % 4 + 1)) * step;
+            }
+        }
+        break :blk sizes;
+    };
+    fn sizeClass(size: usize) usize {
+        std.debug.assert(size <= medium_max);
+        if (size <= 128) return (size -| 1) >> 4;
+        const shift = std.math.log2_int(usize, size - 1);
+        const sub = ((size - 1) >> (shift - 2)) & 3;
+        return 8 + (@as(usize, shift) - 7) * 4 + sub;
+    }
+
+    /// The smallest size class that fits size and whose blocks are all aligned to alignment
+    fn alignedSizeClass(size: usize, alignment: usize) ?usize {
+        if (size > mmap_threshold or alignment > max_class_align) return null;
+        var class = sizeClass(@max(size, alignment));
+        while (class < class_count) : (class += 1) {
+            if (class_sizes[class] % alignment == 0) return class;
+        }
+        return null;
+    }
+
+    /// A free block, linked through its first word
+    const Block = struct {
+        next: ?*Block,
+    };
+
+    const PageKind = enum { small, medium, huge };
+
+    /// Set in Page.thread_free while the page is full.  The thread that
+    /// clears it is responsible for handing the page back to its heap.
+    const delayed_flag: usize = 1;
+
+    const Page = struct {
+        prev: ?*Page = null,
+        next: ?*Page = null,
+        /// only accessed by the thread that owns the page
+        free: ?*Block = null,
+        /// Blocks freed by other threads.  A lock-free stack of blocks
+        /// that the owner takes all at once, the low bit is delayed_flag.
+        thread_free: usize = 0,
+        /// links full pages that have been freed into by other threads, see Heap.delayed
+        next_delayed: ?*Page = null,
+        /// blocks at this index and above have never been handed out
+        reserved: u32 = 0,
+        capacity: u32 = 0,
+        /// number of blocks currently handed out
+        used: u32 = 0,
+        block_size: u32 = 0,
+        class: u8 = 0,
+        index: u8,
+        in_use: bool = false,
+        /// a full page is taken out of its queue until one of its blocks is freed
+        full: bool = false,
+        /// The memory past the reserved blocks is known to be zero so calloc
+        /// doesn't have to clear them.  This outlives the page so malloc_trim
+        /// can skip slots it already released.
+        is_zero: bool = true,
+
+        fn start(page: *Page) [*]u8 {
+            const segment = segmentOf(page);
+            const offset = @max(segment_info_size, @as(usize, page.index) << segment.page_shift);
+            return @as([*]u8, @ptrCast(segment)) + offset;
+        }
+
+        fn len(page: *Page) usize {
+            const segment = segmentOf(page);
+            const page_end = @as(usize, page.index + 1) << segment.page_shift;
+            return page_end - (@intFromPtr(page.start()) - @intFromPtr(segment));
+        }
+
+        /// Gives the pages of this slot back to the OS, the next time they
+        /// are touched they come back zeroed.
+        fn decommit(page: *Page) void {
+            if (builtin.os.tag != .linux) return;
+            _ = std.os.linux.syscall3(.madvise, @intFromPtr(page.start()), page.len(), std.os.linux.MADV.DONTNEED);
+            page.is_zero = true;
+        }
+
+        /// When zero is set the block is cleared unless it's known to be zero already
+        fn popBlock(page: *Page, comptime zero: bool) ?[*]u8 {
+            if (page.free) |free_block| {
+                page.free = free_block.next;
+                page.used += 1;
+                const block: [*]u8 = @ptrCast(free_block);
+                if (zero) @memset(block[0..page.block_size], 0);
+                return block;
+            }
+            if (page.reserved < page.capacity) {
+                const block = page.start() + @as(usize, page.reserved) * page.block_size;
+                page.reserved += 1;
+                page.used += 1;
+                if (zero and !page.is_zero) @memset(block[0..page.block_size], 0);
+                return block;
+            }
+            return null;
+        }
+
+        /// Move the blocks freed by other threads to the local free list,
+        /// returns the number of blocks moved
+        fn collectThreadFree(page: *Page) usize {
+            if (@atomicLoad(usize, &page.thread_free, .Monotonic) == 0) return 0;
+            const head = @atomicRmw(usize, &page.thread_free, .Xchg, 0, .Acquire);
+            // pages in a queue are never full so the flag can't be set
+            std.debug.assert(head & delayed_flag == 0);
+            var next: ?*Block = @ptrFromInt(head);
+            var count: usize = 0;
+            while (next) |block| {
+                next = block.next;
+                block.next = page.free;
+                page.free = block;
+                count += 1;
+            }
+            page.used -= @intCast(count);
+            return count;
+        }
+
+        /// Returns false if another thread freed a block since we last
+        /// collected, in which case the page isn't actually full.
+        fn markFull(page: *Page) bool {
+            if (@cmpxchgStrong(usize, &page.thread_free, 0, delayed_flag, .AcqRel, .Monotonic) != null)
+                return false;
+            page.full = true;
+            return true;
+        }
+    };
+
+    const Segment = struct {
+        prev: ?*Segment = null,
+        next: ?*Segment = null,
+        /// the heap of the thread that allocated this segment, only that
+        /// thread allocates from it
+        heap: *Heap,
+        kind: PageKind,
+        page_shift: u5,
+        /// length of the mapping that starts at the segment
+        size: usize,
+        /// where the block of a huge segment starts
+        data_offset: usize = 0,
+        /// bytes at the start of the segment advised to use huge pages
+        huge_page_len: usize = 0,
+        /// bit i is set when pages[i] is not in use
+        free_pages: u64,
+        used_pages: u32 = 0,
+        pages: [max_page_count]Page,
+
+        fn pageOf(segment: *Segment, ptr: [*]const u8) *Page {
+            return &segment.pages[(@intFromPtr(ptr) - @intFromPtr(segment)) >> segment.page_shift];
+        }
+    };
+
+    fn segmentOf(ptr: *const anyopaque) *Segment {
+        return @ptrFromInt(@intFromPtr(ptr) & ~@as(usize, segment_size - 1));
+    }
+
+    fn freeSegment(segment: *Segment) void {
+        _ = @atomicRmw(usize, &segment_bytes, .Sub, segment.size, .Monotonic);
+        _ = @atomicRmw(usize, &huge_page_bytes, .Sub, segment.huge_page_len, .Monotonic);
+        osFree(@ptrCast(@alignCast(segment)), segment.size);
+    }
+
+    /// Set ZIGLIBC_MALLOC_HUGEPAGES=1 to ask linux to back segments and huge
+    /// blocks with transparent huge pages, which cuts down on TLB misses for
+    /// programs with large heaps.  Every segment is aligned to segment_size
+    /// so they always start on a huge page boundary.  The catch is that
+    /// touching a single byte can fault in a whole huge page.
+    const huge_page_size = 2 * 1024 * 1024;
+    const Tunable = enum(u8) { unknown, off, on };
+    var huge_pages_tunable = Tunable.unknown;
+
+    fn hugePagesEnabled() bool {
+        switch (@atomicLoad(Tunable, &huge_pages_tunable, .Monotonic)) {
+            .off => return false,
+            .on => return true,
+            .unknown => {
+                const value = std.os.getenv("ZIGLIBC_MALLOC_HUGEPAGES") orelse "0";
+                const enabled = !std.mem.eql(u8, value, "0");
+                @atomicStore(Tunable, &huge_pages_tunable, if (enabled) .on else .off, .Monotonic);
+                return enabled;
+            },
+        }
+    }
+
+    /// Advises the segment's huge page aligned part to use huge pages
+    fn adviseHugePages(segment: *Segment) void {
+        if (builtin.os.tag != .linux or !hugePagesEnabled()) return;
+        const len = std.mem.alignBackward(usize, segment.size, huge_page_size);
+        if (len <= segment.huge_page_len) return;
+        const rc = std.os.linux.syscall3(.madvise, @intFromPtr(segment), len, std.os.linux.MADV.HUGEPAGE);
+        if (std.os.errno(rc) != .SUCCESS) return;
+        _ = @atomicRmw(usize, &huge_page_bytes, .Add, len - segment.huge_page_len, .Monotonic);
+        segment.huge_page_len = len;
+    }
+
+    /// An intrusive doubly linked list through the prev/next fields of T
+    fn List(comptime T: type) type {
+        return struct {
+            first: ?*T = null,
+
+            fn push(self: *@This(), node: *T) void {
+                node.prev = null;
+                node.next = self.first;
+                if (self.first) |first| first.prev = node;
+                self.first = node;
+            }
+            fn remove(self: *@This(), node: *T) void {
+                if (node.prev) |prev| prev.next = node.next else self.first = node.next;
+                if (node.next) |next| next.prev = node.prev;
+                node.prev = null;
+                node.next = null;
+            }
+        };
+    }
+
+    /// Every thread that calls malloc gets its own heap, so allocating and
+    /// freeing on the same thread never takes a lock.  Blocks freed by other
+    /// threads go through Page.thread_free.  When a thread exits its heap is
+    /// abandoned and the next new thread adopts it, along with everything
+    /// other threads freed into it in the meantime.
+    const Heap = struct {
+        /// pages that may have free blocks, for each size class
+        pages: [class_count]List(Page) = [_]List(Page){.{}} ** class_count,
+        /// segments that have unused pages, for small and medium pages
+        segments: [2]List(Segment) = [_]List(Segment){.{}} ** 2,
+        /// an empty segment kept around so a heap that goes back and forth
+        /// between 0 and 1 pages doesn't call mmap/munmap every time
+        cached_segment: ?*Segment = null,
+        /// Lock-free stack of full pages that other threads have freed
+        /// blocks into, linked through Page.next_delayed.
+        delayed: usize = 0,
+        /// links every heap that has been created
+        next_heap: ?*Heap = null,
+        /// links the heaps of exited threads, guarded by abandoned_mutex
+        next_abandoned: ?*Heap = null,
+        /// only updated by the owner, block_size is unused
+        class_stats: [class_count]ClassStats = [_]ClassStats{.{}} ** class_count,
+
+        fn allocSegment(self: *Heap, kind: PageKind) ?*Segment {
+            var fresh = false;
+            var huge_page_len: usize = 0;
+            const segment: *Segment = if (self.cached_segment) |cached| blk: {
+                self.cached_segment = null;
+                huge_page_len = cached.huge_page_len;
+                break :blk cached;
+            } else blk: {
+                const mem = osAlloc(segment_size, segment_size) orelse return null;
+                _ = @atomicRmw(usize, &segment_bytes, .Add, segment_size, .Monotonic);
+                fresh = true;
+                break :blk @ptrCast(mem);
+            };
+
+            const page_shift: u5 = switch (kind) {
+                .small => small_page_shift,
+                .medium => medium_page_shift,
+                .huge => unreachable,
+            };
+            const page_count = @as(usize, segment_size) >> page_shift;
+            segment.* = .{
+                .heap = self,
+                .kind = kind,
+                .page_shift = page_shift,
+                .size = segment_size,
+                .free_pages = std.math.maxInt(u64) >> @intCast(64 - page_count),
+                .huge_page_len = huge_page_len,
+                .pages = undefined,
+            };
+            if (fresh) adviseHugePages(segment);
+            for (&segment.pages, 0..) |*page, i| {
+                // a cached segment may have been written to anywhere
+                page.* = .{ .index = @intCast(i), .is_zero = fresh };
+            }
+            // small pages are the same size as the segment header, so the first one is unusable
+            if (kind == .small) segment.free_pages &= ~@as(u64, 1);
+            self.segments[@intFromEnum(kind)].push(segment);
+            return segment;
+        }
+
+        fn releaseSegment(self: *Heap, segment: *Segment) void {
+            self.segments[@intFromEnum(segment.kind)].remove(segment);
+            if (self.cached_segment == null) {
+                self.cached_segment = segment;
+            } else {
+                freeSegment(segment);
+            }
+        }
+
+        fn allocPage(self: *Heap, class: usize) ?*Page {
+            const block_size = class_sizes[class];
+            const kind: PageKind = if (block_size <= small_max) .small else .medium;
+            const segment = self.segments[@intFromEnum(kind)].first orelse
+                (self.allocSegment(kind) orelse return null);
+
+            const index = @ctz(segment.free_pages);
+            segment.free_pages &= ~(@as(u64, 1) << @intCast(index));
+            segment.used_pages += 1;
+            if (segment.free_pages == 0) self.segments[@intFromEnum(kind)].remove(segment);
+
+            const page = &segment.pages[index];
+            const is_zero = page.is_zero;
+            page.* = .{
+                .index = @intCast(index),
+                .block_size = block_size,
+                .class = @intCast(class),
+                .in_use = true,
+                .is_zero = is_zero,
+            };
+            page.capacity = @intCast(page.len() / block_size);
+            self.class_stats[class].pages += 1;
+            self.class_stats[class].capacity += page.capacity;
+            self.pages[class].push(page);
+            return page;
+        }
+
+        fn retirePage(self: *Heap, page: *Page) void {
+            const segment = segmentOf(page);
+            self.pages[page.class].remove(page);
+            page.in_use = false;
+            if (page.reserved != 0) page.is_zero = false;
+            self.class_stats[page.class].pages -= 1;
+            self.class_stats[page.class].capacity -= page.capacity;
+            if (segment.free_pages == 0) self.segments[@intFromEnum(segment.kind)].push(segment);
+            segment.free_pages |= @as(u64, 1) << @intCast(page.index);
+            segment.used_pages -= 1;
+            if (segment.used_pages == 0) self.releaseSegment(segment);
+        }
+
+        /// Put full pages that other threads freed into back in their queues
+        fn collectDelayed(self: *Heap) void {
+            if (@atomicLoad(usize, &self.delayed, .Monotonic) == 0) return;
+            var next: ?*Page = @ptrFromInt(@atomicRmw(usize, &self.delayed, .Xchg, 0, .Acquire));
+            while (next) |page| {
+                next = page.next_delayed;
+                page.full = false;
+                self.pages[page.class].push(page);
+            }
+        }
+
+        fn pushDelayed(self: *Heap, page: *Page) void {
+            var head = @atomicLoad(usize, &self.delayed, .Monotonic);
+            while (true) {
+                page.next_delayed = @ptrFromInt(head);
+                head = @cmpxchgWeak(usize, &self.delayed, head, @intFromPtr(page), .Release, .Monotonic) orelse return;
+            }
+        }
+
+        fn allocSlow(self: *Heap, class: usize, comptime zero: bool) ?[*]u8 {
+            self.collectDelayed();
+            const queue = &self.pages[class];
+            while (queue.first) |page| {
+                self.class_stats[class].used -= page.collectThreadFree();
+                if (page.popBlock(zero)) |block| return block;
+                if (page.markFull()) queue.remove(page);
+            }
+            const page = self.allocPage(class) orelse return null;
+            return page.popBlock(zero).?;
+        }
+    };
+
+    // process-wide counters for stats()
+    var segment_bytes: usize = 0;
+    var huge_count: usize = 0;
+    var huge_bytes: usize = 0;
+    var huge_page_bytes: usize = 0;
+
+    threadlocal var thread_heap: ?*Heap = null;
+    /// the first thread to allocate gets this heap so single-threaded
+    /// programs don't need to map one
+    var main_heap = Heap{};
+    var main_heap_taken = false;
+    /// every heap, linked through Heap.next_heap
+    var heaps: usize = 0;
+    /// heaps of threads that have exited, linked through Heap.next_abandoned.
+    /// Only touched when threads start and exit so a mutex is fine.
+    var abandoned: ?*Heap = null;
+    var abandoned_mutex = std.Thread.Mutex{};
+    /// set by threadExit, the thread's heap is gone and its allocations go
+    /// to exited_heap from then on
+    threadlocal var thread_exited = false;
+    /// Shared by threads that allocate after threadExit, a TLS destructor
+    /// that runs after it say.  It has no owner, allocations from it take
+    /// exited_mutex and frees into it all go through Page.thread_free.
+    var exited_heap: ?*Heap = null;
+    var exited_mutex = std.Thread.Mutex{};
+
+    fn adoptHeap() ?*Heap {
+        abandoned_mutex.lock();
+        defer abandoned_mutex.unlock();
+        const heap = abandoned orelse return null;
+        abandoned = heap.next_abandoned;
+        heap.next_abandoned = null;
+        return heap;
+    }
+
+    fn initThreadHeap() ?*Heap {
+        if (adoptHeap()) |heap| {
+            // it's already in the heaps list, the pages other threads freed
+            // into while it had no owner are picked up by allocSlow
+            thread_heap = heap;
+            return heap;
+        }
+        const heap = newHeap() orelse return null;
+        thread_heap = heap;
+        return heap;
+    }
+
+    /// Creates a heap and adds it to the heaps list
+    fn newHeap() ?*Heap {
+        const new_heap: *Heap = if (!@atomicRmw(bool, &main_heap_taken, .Xchg, true, .AcqRel))
+            &main_heap
+        else blk: {
+            const mem = osAlloc(std.mem.alignForward(usize, @sizeOf(Heap), std.mem.page_size), std.mem.page_size) orelse return null;
+            const result: *Heap = @ptrCast(mem);
+            result.* = .{};
+            break :blk result;
+        };
+        var head = @atomicLoad(usize, &heaps, .Monotonic);
+        while (true) {
+            new_heap.next_heap = @ptrFromInt(head);
+            head = @cmpxchgWeak(usize, &heaps, head, @intFromPtr(new_heap), .Release, .Monotonic) orelse break;
+        }
+        return new_heap;
+    }
+
+    /// Called when a thread exits.  Its segments still hold blocks that may be
+    /// in use, so the heap is kept for the next thread instead of unmapped.
+    fn threadExit() void {
+        thread_exited = true;
+        const heap = thread_heap orelse return;
+        thread_heap = null;
+        if (heap.cached_segment) |segment| {
+            heap.cached_segment = null;
+            freeSegment(segment);
+        }
+        abandoned_mutex.lock();
+        defer abandoned_mutex.unlock();
+        heap.next_abandoned = abandoned;
+        abandoned = heap;
+    }
+
+    /// the block of a huge segment starts after the header, or at the first
+    /// multiple of its alignment after that
+    const huge_data_offset = std.mem.alignForward(usize, @offsetOf(Segment, "pages"), alloc_align);
+
+    fn hugeLen(data_offset: usize, size: usize) ?usize {
+        return std.mem.alignForward(
+            usize,
+            std.math.add(usize, data_offset, size) catch return null,
+            std.mem.page_size,
+        );
+    }
+
+    fn hugeData(segment: *Segment) [*]align(alloc_align) u8 {
+        return @alignCast(@as([*]u8, @ptrCast(segment)) + segment.data_offset);
+    }
+
+    fn allocHuge(size: usize, alignment: usize) ?[*]align(alloc_align) u8 {
+        // the block has to be in the first segment_size bytes to find its header
+        if (alignment >= segment_size) return null;
+        const data_offset = std.mem.alignForward(usize, huge_data_offset, alignment);
+        const len = hugeLen(data_offset, size) orelse return null;
+        const segment: *Segment = @ptrCast(osAlloc(len, segment_size) orelse return null);
+        segment.kind = .huge;
+        segment.size = len;
+        segment.data_offset = data_offset;
+        _ = @atomicRmw(usize, &huge_count, .Add, 1, .Monotonic);
+        _ = @atomicRmw(usize, &huge_bytes, .Add, len, .Monotonic);
+        adviseHugePages(segment);
+        return hugeData(segment);
+    }
+
+    /// Resizes a huge block by remapping its pages so its data is never copied.
+    /// Returns null if the mapping couldn't be resized.
+    fn remapHuge(segment: *Segment, size: usize) ?*Segment {
+        const new_len = hugeLen(segment.data_offset, size) orelse return null;
+        const old_mem: [*]align(std.mem.page_size) u8 = @ptrCast(@alignCast(segment));
+        if (new_len <= segment.size) {
+            if (new_len < segment.size) std.os.munmap(@alignCast(old_mem[new_len..segment.size]));
+            segment.size = new_len;
+            return segment;
+        }
+        if (mremap(old_mem, segment.size, new_len, 0, null)) |_| {
+            segment.size = new_len;
+            return segment;
+        }
+        // The block has to stay segment aligned so it can still find its
+        // header.  Reserve an aligned range and have the kernel move the
+        // pages there.
+        const target = mapAligned(new_len, segment_size, std.os.PROT.NONE) orelse return null;
+        const new_mem = mremap(old_mem, segment.size, new_len, MREMAP.MAYMOVE | MREMAP.FIXED, target) orelse {
+            std.os.munmap(target[0..new_len]);
+            return null;
+        };
+        const new_segment: *Segment = @ptrCast(new_mem);
+        new_segment.size = new_len;
+        return new_segment;
+    }
+
+    fn realloc(ptr: [*]align(alloc_align) u8, size: usize) ?[*]align(alloc_align) u8 {
+        const segment = segmentOf(ptr);
+        if (builtin.os.tag == .linux and segment.kind == .huge and size > mmap_threshold) {
+            const old_len = segment.size;
+            if (remapHuge(segment, size)) |new_segment| {
+                _ = @atomicRmw(usize, &huge_bytes, .Sub, old_len, .Monotonic);
+                _ = @atomicRmw(usize, &huge_bytes, .Add, new_segment.size, .Monotonic);
+                // a shrunk mapping may have lost some of its huge pages
+                const huge_page_len = @min(new_segment.huge_page_len, std.mem.alignBackward(usize, new_segment.size, huge_page_size));
+                _ = @atomicRmw(usize, &huge_page_bytes, .Sub, new_segment.huge_page_len - huge_page_len, .Monotonic);
+                new_segment.huge_page_len = huge_page_len;
+                adviseHugePages(new_segment);
+                return hugeData(new_segment);
+            }
+        }
+        return reallocCopy(ptr, size);
+    }
+
+    fn alloc(size: usize) ?[*]align(alloc_align) u8 {
+        if (size > mmap_threshold) return allocHuge(size, alloc_align);
+        return allocClass(sizeClass(size), false);
+    }
+
+    /// Huge blocks are always fresh from the OS and blocks that are carved
+    /// out of untouched pages are already zero, only reused blocks need clearing.
+    fn allocZeroed(size: usize) ?[*]align(alloc_align) u8 {
+        if (size > mmap_threshold) return allocHuge(size, alloc_align);
+        return allocClass(sizeClass(size), true);
+    }
+
+    /// Small alignments are served from a size class that is a multiple of
+    /// the alignment, so there's no padding to waste.
+    fn allocAligned(size: usize, alignment: usize) ?[*]align(alloc_align) u8 {
+        if (alignedSizeClass(size, alignment)) |class| return allocClass(class, false);
+        return allocHuge(size, alignment);
+    }
+
+    fn allocClass(class: usize, comptime zero: bool) ?[*]align(alloc_align) u8 {
+        if (thread_heap) |heap| return allocFrom(heap, class, zero);
+        if (thread_exited) {
+            // thread_heap stays null so frees from this thread are remote
+            // frees, which don't need exited_mutex
+            exited_mutex.lock();
+            defer exited_mutex.unlock();
+            if (exited_heap == null) exited_heap = newHeap();
+            return allocFrom(exited_heap orelse return null, class, zero);
+        }
+        return allocFrom(initThreadHeap() orelse return null, class, zero);
+    }
+
+    fn allocFrom(self: *Heap, class: usize, comptime zero: bool) ?[*]align(alloc_align) u8 {
+        const block = blk: {
+            if (self.pages[class].first) |page| {
+                if (page.popBlock(zero)) |popped| break :blk popped;
+            }
+            break :blk self.allocSlow(class, zero) orelse return null;
+        };
+        self.class_stats[class].used += 1;
+        return @alignCast(block);
+    }
+
+    fn free(ptr: [*]align(alloc_align) u8) void {
+        const segment = segmentOf(ptr);
+        if (segment.kind == .huge) {
+            _ = @atomicRmw(usize, &huge_count, .Sub, 1, .Monotonic);
+            _ = @atomicRmw(usize, &huge_bytes, .Sub, segment.size, .Monotonic);
+            _ = @atomicRmw(usize, &huge_page_bytes, .Sub, segment.huge_page_len, .Monotonic);
+            osFree(@ptrCast(@alignCast(segment)), segment.size);
+            return;
+        }
+
+        const page = segment.pageOf(ptr);
+        std.debug.assert(page.in_use);
+        const block: *Block = @ptrCast(ptr);
+        if (segment.heap != thread_heap) {
+            freeRemote(segment.heap, page, block);
+            return;
+        }
+
+        block.next = page.free;
+        page.free = block;
+        page.used -= 1;
+        const self = segment.heap;
+        self.class_stats[page.class].used -= 1;
+        if (page.full) {
+            // if another thread cleared the flag first, it has already
+            // pushed the page to heap.delayed and it will be requeued from there
+            if (null == @cmpxchgStrong(usize, &page.thread_free, delayed_flag, 0, .AcqRel, .Monotonic)) {
+                page.full = false;
+                self.pages[page.class].push(page);
+            }
+        } else if (page.used == 0 and self.pages[page.class].first != page) {
+            // keep the first page around even when it's empty so a program
+            // that allocates and frees in a loop doesn't keep getting new pages
+            self.retirePage(page);
+        }
+    }
+
+    fn freeRemote(owner: *Heap, page: *Page, block: *Block) void {
+        var head = @atomicLoad(usize, &page.thread_free, .Monotonic);
+        while (true) {
+            block.next = @ptrFromInt(head & ~delayed_flag);
+            head = @cmpxchgWeak(usize, &page.thread_free, head, @intFromPtr(block), .Release, .Monotonic) orelse break;
+        }
+        // we cleared the flag so we have to tell the owner the page isn't full anymore
+        if (head & delayed_flag != 0) owner.pushDelayed(page);
+    }
+
+    fn usableSize(ptr: [*]align(alloc_align) u8) usize {
+        const segment = segmentOf(ptr);
+        if (segment.kind == .huge) return segment.size - segment.data_offset;
+        return segment.pageOf(ptr).block_size;
+    }
+
+    fn stats() Stats {
+        var result = Stats{
+            .segment_bytes = @atomicLoad(usize, &segment_bytes, .Monotonic),
+            .huge_count = @atomicLoad(usize, &huge_count, .Monotonic),
+            .huge_bytes = @atomicLoad(usize, &huge_bytes, .Monotonic),
+            .huge_page_bytes = @atomicLoad(usize, &huge_page_bytes, .Monotonic),
+        };
+        for (&result.classes, class_sizes) |*class, size| class.block_size = size;
+        var next: ?*Heap = @ptrFromInt(@atomicLoad(usize, &heaps, .Acquire));
+        while (next) |heap| : (next = heap.next_heap) {
+            if (heap.cached_segment != null) result.cached_bytes += segment_size;
+            for (&result.classes, heap.class_stats) |*total, class| {
+                total.pages += class.pages;
+                total.capacity += class.capacity;
+                total.used += class.used;
+            }
+        }
+        for (result.classes) |class| result.in_use += class.used * class.block_size;
+        return result;
+    }
+
+    /// Only the calling thread's heap is trimmed, the other heaps belong
+    /// to threads that could be using them.
+    fn trim() bool {
+        const self = thread_heap orelse return false;
+        var released = false;
+        if (self.cached_segment) |segment| {
+            self.cached_segment = null;
+            freeSegment(segment);
+            released = true;
+        }
+        // the first page of a queue is kept even when it's empty
+        for (&self.pages) |*queue| {
+            var next = queue.first;
+            while (next) |page| : (next = page.next) {
+                if (page.used != 0 or page.reserved == 0) continue;
+                page.free = null;
+                page.reserved = 0;
+                page.decommit();
+                released = true;
+            }
+        }
+        for (&self.segments) |*list| {
+            var next = list.first;
+            while (next) |segment| : (next = segment.next) {
+                var free_pages = segment.free_pages;
+                while (free_pages != 0) : (free_pages &= free_pages - 1) {
+                    const page = &segment.pages[@ctz(free_pages)];
+                    if (page.is_zero) continue;
+                    page.decommit();
+                    released = true;
+                }
+            }
+        }
+        return released;
+    }
+};
+
+/// Allocates len bytes (a multiple of the page size) aligned to alignment
+/// directly from the OS.  The memory is zero-initialized.
+fn osAlloc(len: usize, alignment: usize) ?[*]align(std.mem.page_size) u8 {
+    if (builtin.os.tag == .windows) {
+        const windows = std.os.windows;
+        // reserve enough to find an aligned range inside it, then release it and
+        // map exactly that range.  another thread could map it first so retry.
+        var attempt: u8 = 0;
+        while (attempt < 10) : (attempt += 1) {
+            const probe = windows.VirtualAlloc(null, len + alignment, windows.MEM_RESERVE, windows.PAGE_NOACCESS) catch return null;
+            const start = std.mem.alignForward(usize, @intFromPtr(probe), alignment);
+            windows.VirtualFree(probe, 0, windows.MEM_RELEASE);
+            const result = windows.VirtualAlloc(
+                @ptrFromInt(start),
+                len,
+                windows.MEM_RESERVE | windows.MEM_COMMIT,
+                windows.PAGE_READWRITE,
+            ) catch continue;
+            return @ptrCast(@alignCast(result));
+        }
+        return null;
+    }
+
+    return mapAligned(len, alignment, std.os.PROT.READ | std.os.PROT.WRITE);
+}
+
+fn mapAligned(len: usize, alignment: usize, prot: u32) ?[*]align(std.mem.page_size) u8 {
+    // over-allocate so we can trim the mapping down to an aligned range
+    const full_len = std.math.add(usize, len, alignment - std.mem.page_size) catch return null;
+    const mem = std.os.mmap(
+        null,
+        full_len,
+        prot,
+        std.os.MAP.PRIVATE | std.os.MAP.ANONYMOUS,
+        -1,
+        0,
+    ) catch return null;
+    const prefix_len = std.mem.alignForward(usize, @intFromPtr(mem.ptr), alignment) - @intFromPtr(mem.ptr);
+    if (prefix_len > 0) std.os.munmap(mem[0..prefix_len]);
+    const suffix_len = full_len - prefix_len - len;
+    if (suffix_len > 0) std.os.munmap(@alignCast(mem[prefix_len + len ..]));
+    return @alignCast(mem.ptr + prefix_len);
+}
+
+const MREMAP = struct {
+    const MAYMOVE = 1;
+    const FIXED = 2;
+};
+
+fn mremap(
+    old_mem: [*]align(std.mem.page_size) u8,
+    old_len: usize,
+    new_len: usize,
+    flags: usize,
+    new_addr: ?[*]align(std.mem.page_size) u8,
+) ?[*]align(std.mem.page_size) u8 {
+    const rc = std.os.linux.syscall5(
+        .mremap,
+        @intFromPtr(old_mem),
+        old_len,
+        new_len,
+        flags,
+        if (new_addr) |addr| @intFromPtr(addr) else 0,
+    );
+    return switch (std.os.errno(rc)) {
+        .SUCCESS => @ptrFromInt(rc),
+        else => null,
+    };
+}
+
+fn osFree(ptr: [*]align(std.mem.page_size) u8, len: usize) void {
+    if (builtin.os.tag == .windows) {
+        std.os.windows.VirtualFree(ptr, 0, std.os.windows.MEM_RELEASE);
+    } else {
+        std.os.munmap(ptr[0..len]);
+    }
+}
+
+// --------------------------------------------------------------------------------
+// debug backend
+// --------------------------------------------------------------------------------
+const debug = struct {
+    var gpa = std.heap.GeneralPurposeAllocator(.{
+        .MutexType = std.Thread.Mutex,
+    }){};
+
+    /// stored right before every block
+    const Header = struct {
+        /// length of the whole allocation from the gpa
+        len: usize,
+        /// distance from the start of the allocation to the block
+        offset: usize,
+        log2_align: u8,
+    };
+    const metadata_len = std.mem.alignForward(usize, @sizeOf(Header), alloc_align);
+
+    fn getHeader(ptr: [*]align(alloc_align) u8) *Header {
+        return @ptrCast(@alignCast(ptr - @sizeOf(Header)));
+    }
+
+    fn getGpaBuf(ptr: [*]align(alloc_align) u8) []u8 {
+        const header = getHeader(ptr);
+        return (ptr - header.offset)[0..header.len];
+    }
+
+    fn alloc(size: usize) ?[*]align(alloc_align) u8 {
+        return allocAligned(size, alloc_align);
+    }
+
+    fn allocAligned(size: usize, alignment: usize) ?[*]align(alloc_align) u8 {
+        const offset = @max(metadata_len, alignment);
+        const full_len = std.math.add(usize, offset, size) catch return null;
+        const log2_align: u8 = std.math.log2_int(usize, alignment);
+        const buf = gpa.allocator().rawAlloc(full_len, log2_align, @returnAddress()) orelse return null;
+        const ptr: [*]align(alloc_align) u8 = @alignCast(buf + offset);
+        getHeader(ptr).* = .{ .len = full_len, .offset = offset, .log2_align = log2_align };
+        return ptr;
+    }
+
+    fn allocZeroed(size: usize) ?[*]align(alloc_align) u8 {
+        const ptr = alloc(size) orelse return null;
+        @memset(ptr[0..size], 0);
+        return ptr;
+    }
+
+    fn free(ptr: [*]align(alloc_align) u8) void {
+        gpa.allocator().rawFree(getGpaBuf(ptr), getHeader(ptr).log2_align, @returnAddress());
+    }
+
+    fn usableSize(ptr: [*]align(alloc_align) u8) usize {
+        const header = getHeader(ptr);
+        return header.len - header.offset;
+    }
+
+    const realloc = reallocCopy;
+
+    // the GeneralPurposeAllocator doesn't expose anything to report
+    fn stats() Stats {
+        return .{};
+    }
+    fn trim() bool {
+        return false;
+    }
+    fn threadExit() void {}
+};
+
+// --------------------------------------------------------------------------------
+// bump backend
+// --------------------------------------------------------------------------------
+const bump = struct {
+    const chunk_size = 1024 * 1024;
+    /// Blocks bigger than this get their own mapping which free does unmap.
+    /// Small enough that a block always fits in a new chunk.
+    const mmap_threshold = chunk_size / 4;
+
+    /// stored right before every block
+    const Header = struct {
+        size: usize,
+        /// 0 for blocks in a chunk
+        mapping_len: usize,
+        /// distance from the start of the mapping to the block
+        mapping_offset: usize,
+    };
+
+    // every thread bumps through its own chunk
+    threadlocal var cursor: usize = 0;
+    threadlocal var end: usize = 0;
+
+    var chunk_bytes: usize = 0;
+    var mapped_count: usize = 0;
+    var mapped_bytes: usize = 0;
+
+    fn getHeader(ptr: [*]align(alloc_align) u8) *Header {
+        return @ptrCast(@alignCast(ptr - @sizeOf(Header)));
+    }
+
+    fn alloc(size: usize) ?[*]align(alloc_align) u8 {
+        return allocAligned(size, alloc_align);
+    }
+
+    fn allocAligned(size: usize, alignment: usize) ?[*]align(alloc_align) u8 {
+        if (size > mmap_threshold or alignment > mmap_threshold) return allocMapped(size, alignment);
+        while (true) {
+            const start = std.mem.alignForward(usize, cursor + @sizeOf(Header), alignment);
+            if (start + size <= end) {
+                cursor = start + size;
+                const ptr: [*]align(alloc_align) u8 = @ptrFromInt(start);
+                getHeader(ptr).* = .{ .size = size, .mapping_len = 0, .mapping_offset = 0 };
+                return ptr;
+            }
+            // the rest of the current chunk is abandoned
+            const chunk = osAlloc(chunk_size, std.mem.page_size) orelse return null;
+            _ = @atomicRmw(usize, &chunk_bytes, .Add, chunk_size, .Monotonic);
+            cursor = @intFromPtr(chunk);
+            end = cursor + chunk_size;
+        }
+    }
+
+    fn allocMapped(size: usize, alignment: usize) ?[*]align(alloc_align) u8 {
+        const offset = std.mem.alignForward(usize, @sizeOf(Header), alignment);
+        const len = std.mem.alignForward(
+            usize,
+            std.math.add(usize, offset, size) catch return null,
+            std.mem.page_size,
+        );
+        const mem = osAlloc(len, @max(alignment, std.mem.page_size)) orelse return null;
+        _ = @atomicRmw(usize, &mapped_count, .Add, 1, .Monotonic);
+        _ = @atomicRmw(usize, &mapped_bytes, .Add, len, .Monotonic);
+        const ptr: [*]align(alloc_align) u8 = @alignCast(mem + offset);
+        getHeader(ptr).* = .{ .size = size, .mapping_len = len, .mapping_offset = offset };
+        return ptr;
+    }
+
+    // chunks are never reused so every block is still zero
+    const allocZeroed = alloc;
+
+    fn free(ptr: [*]align(alloc_align) u8) void {
+        const header = getHeader(ptr);
+        if (header.mapping_len == 0) return;
+        _ = @atomicRmw(usize, &mapped_count, .Sub, 1, .Monotonic);
+        _ = @atomicRmw(usize, &mapped_bytes, .Sub, header.mapping_len, .Monotonic);
+        osFree(@alignCast(ptr - header.mapping_offset), header.mapping_len);
+    }
+
+    fn usableSize(ptr: [*]align(alloc_align) u8) usize {
+        const header = getHeader(ptr);
+        if (header.mapping_len == 0) return header.size;
+        return header.mapping_len - header.mapping_offset;
+    }
+
+    fn realloc(ptr: [*]align(alloc_align) u8, size: usize) ?[*]align(alloc_align) u8 {
+        // the last block of the chunk can grow in place, it never shrinks
+        // because that would hand out dirty memory to calloc
+        const header = getHeader(ptr);
+        if (header.mapping_len == 0 and @intFromPtr(ptr) + header.size == cursor and size >= header.size and size <= end - @intFromPtr(ptr)) {
+            cursor = @intFromPtr(ptr) + size;
+            header.size = size;
+            return ptr;
+        }
+        return reallocCopy(ptr, size);
+    }
+
+    /// The unused part of other threads' chunks is counted as in use
+    fn stats() Stats {
+        const chunk_total = @atomicLoad(usize, &chunk_bytes, .Monotonic);
+        return .{
+            .segment_bytes = chunk_total,
+            .in_use = chunk_total - (end - cursor),
+            .huge_count = @atomicLoad(usize, &mapped_count, .Monotonic),
+            .huge_bytes = @atomicLoad(usize, &mapped_bytes, .Monotonic),
+        };
+    }
+
+    fn trim() bool {
+        return false;
+    }
+
+    /// chunks are never given back, the rest of the thread's chunk is lost
+    fn threadExit() void {}
+};
@@ -13,10 +13,16 @@ const c = @cImport({
     @cInclude("sys/time.h");
     @cInclude("sys/stat.h");
     @cInclude("sys/select.h");
+    @cInclude("pthread.h");
 });
 
 const cstd = struct {
     extern fn __zreserveFile() callconv(.C) ?*c.FILE;
+    extern fn __zfillReadBuffer(stream: *c.FILE) callconv(.C) bool;
+    extern fn __zlockStream(stream: *c.FILE) callconv(.C) void;
+    extern fn __zunlockStream(stream: *c.FILE) callconv(.C) void;
+    extern fn __zthreadExit() callconv(.C) void;
+    extern var __libc_single_threaded: u8;
 };
 
 const trace = @import("trace.zig");
@@ -102,6 +108,36 @@ export fn read(fd: c_int, buf: [*]u8, len: usize) callconv(.C) isize {
     }
 }
 
+export fn dup(fd: c_int) callconv(.C) c_int {
+    trace.log("dup {}", .{fd});
+    if (builtin.os.tag == .windows) {
+        @panic("dup not implemented on windows");
+    }
+    const rc = os.system.dup(fd);
+    switch (os.errno(rc)) {
+        .SUCCESS => return @intCast(rc),
+        else => |e| {
+            c.errno = @intFromEnum(e);
+            return -1;
+        },
+    }
+}
+
+export fn dup2(fd: c_int, new_fd: c_int) callconv(.C) c_int {
+    trace.log("dup2 {} {}", .{ fd, new_fd });
+    if (builtin.os.tag == .windows) {
+        @panic("dup2 not implemented on windows");
+    }
+    const rc = os.system.dup2(fd, new_fd);
+    switch (os.errno(rc)) {
+        .SUCCESS => return @intCast(rc),
+        else => |e| {
+            c.errno = @intFromEnum(e);
+            return -1;
+        },
+    }
+}
+
 // --------------------------------------------------------------------------------
 // string
 // --------------------------------------------------------------------------------
@@ -214,6 +250,53 @@ export fn fdopen(fd: c_int, mode: [*:0]const u8) callconv(.C) ?*c.FILE {
     return file;
 }
 
+export fn getline(lineptr: *?[*]u8, n: *usize, stream: *c.FILE) callconv(.C) isize {
+    return getdelim(lineptr, n, '\n', stream);
+}
+
+export fn getdelim(lineptr: *?[*]u8, n: *usize, delim: c_int, stream: *c.FILE) callconv(.C) isize {
+    trace.log("getdelim {*} n={} delim={} stream={*}", .{ lineptr.*, n.*, delim, stream });
+    const delim_byte: u8 = @truncate(@as(c_uint, @bitCast(delim)));
+    cstd.__zlockStream(stream);
+    defer cstd.__zunlockStream(stream);
+    var len: usize = 0;
+    while (true) {
+        if (stream.rpos == stream.rend) {
+            if (stream.eof != 0 or !cstd.__zfillReadBuffer(stream)) break;
+        }
+        // copy straight from the stream buffer up to the delimiter
+        const input = stream.rpos[0 .. @intFromPtr(stream.rend) - @intFromPtr(stream.rpos)];
+        const chunk_len = if (c.memchr(input.ptr, delim_byte, input.len)) |found|
+            @intFromPtr(found) - @intFromPtr(input.ptr) + 1
+        else
+            input.len;
+        if (!growLine(lineptr, n, len + chunk_len + 1)) {
+            c.errno = c.ENOMEM;
+            stream.errno = c.ENOMEM;
+            return -1;
+        }
+        @memcpy(lineptr.*.?[len..][0..chunk_len], input[0..chunk_len]);
+        len += chunk_len;
+        stream.rpos += chunk_len;
+        if (input[chunk_len - 1] == delim_byte) break;
+    }
+    if (len == 0) return -1;
+    lineptr.*.?[len] = 0;
+    return @intCast(len);
+}
+
+/// Makes the getline buffer hold at least size bytes, doubling it so a long
+/// line is only copied a logarithmic number of times.
+fn growLine(lineptr: *?[*]u8, n: *usize, size: usize) bool {
+    if (lineptr.* != null and n.* >= size) return true;
+    var new_size: usize = @max(if (lineptr.* == null) 0 else n.*, 128);
+    while (new_size < size) new_size = std.math.mul(usize, new_size, 2) catch size;
+    const new_line = c.realloc(lineptr.*, new_size) orelse return false;
+    lineptr.* = @ptrCast(new_line);
+    n.* = new_size;
+    return true;
+}
+
 // --------------------------------------------------------------------------------
 // unistd
 // --------------------------------------------------------------------------------
@@ -452,6 +535,52 @@ export fn select(
     @panic("TODO: implement select");
 }
 
+// --------------------------------------------------------------------------------
+// pthread
+// --------------------------------------------------------------------------------
+const StartRoutine = *const fn (arg: ?*anyopaque) callconv(.C) ?*anyopaque;
+
+/// What a pthread_t points to, allocated by pthread_create and freed by
+/// pthread_join
+const Thread = struct {
+    handle: std.Thread,
+    result: ?*anyopaque = null,
+};
+
+fn threadMain(thread: *Thread, start_routine: StartRoutine, arg: ?*anyopaque) void {
+    thread.result = start_routine(arg);
+    cstd.__zthreadExit();
+}
+
+// TODO: attr is ignored, threads are always joinable with the default stack size
+export fn pthread_create(
+    thread_out: *c.pthread_t,
+    attr: ?*const c.pthread_attr_t,
+    start_routine: StartRoutine,
+    arg: ?*anyopaque,
+) callconv(.C) c_int {
+    trace.log("pthread_create", .{});
+    _ = attr;
+    const thread: *Thread = @ptrCast(@alignCast(c.malloc(@sizeOf(Thread)) orelse return c.EAGAIN));
+    thread.* = .{ .handle = undefined };
+    @atomicStore(u8, &cstd.__libc_single_threaded, 0, .Monotonic);
+    thread.handle = std.Thread.spawn(.{}, threadMain, .{ thread, start_routine, arg }) catch {
+        c.free(thread);
+        return c.EAGAIN;
+    };
+    thread_out.* = @intFromPtr(thread);
+    return 0;
+}
+
+export fn pthread_join(thread_id: c.pthread_t, retval: ?*?*anyopaque) callconv(.C) c_int {
+    trace.log("pthread_join", .{});
+    const thread: *Thread = @ptrFromInt(thread_id);
+    thread.handle.join();
+    if (retval) |r| r.* = thread.result;
+    c.free(thread);
+    return 0;
+}
+
 // --------------------------------------------------------------------------------
 // Windows
 // --------------------------------------------------------------------------------
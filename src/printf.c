@@ -9,6 +9,8 @@
 
 // TODO: restrict pointers?
 size_t _fwrite_buf(const char *ptr, size_t size, FILE *stream);
+void __zlockStream(FILE *stream);
+void __zunlockStream(FILE *stream);
 size_t _formatCInt(char *buf, int value, uint8_t base);
 size_t _formatCUint(char *buf, unsigned value, uint8_t base);
 size_t _formatCLong(char *buf, long value, uint8_t base);
@@ -207,11 +209,14 @@ int vfprintf(FILE *stream, const char *format, va_list arg)
   writer.base.write = streamWrite;
   writer.stream = stream;
   size_t written;
-  if (0 == vformat(&written, &writer.base, format, arg)) {
-    return (int)written;
+  // hold the lock so the output isn't interleaved with other threads
+  __zlockStream(stream);
+  int result = vformat(&written, &writer.base, format, arg);
+  if (result != 0) {
+    stream->errno = errno;
   }
-  stream->errno = errno;
-  return -1;
+  __zunlockStream(stream);
+  return (result == 0) ? (int)written : -1;
 }
 
 int vprintf(const char *format, va_list arg)
@@ -0,0 +1,537 @@
+//! Vector kernels behind the string functions.
+//!
+//! The kernels load one aligned block of vec_len bytes at a time, compare
+//! the whole block at once and turn the result into a bit mask, the index
+//! of the first match is the count of trailing zeros.  A block is aligned
+//! to its size so it never crosses a page boundary, which makes it safe to
+//! load the block holding the last byte of a string even though the rest
+//! of the block may not be part of it.  The first block can start before
+//! the string, its mask is shifted to drop those bytes.
+//!
+//! Zig can't enable CPU features for a single function, so on x86_64 the
+//! build compiles the kernels a second and third time, in objects built
+//! for AVX2 and AVX-512 (see simd_variant.zig).  init picks the widest
+//! variant the CPU supports, the start code calls it before main.  Until
+//! then, or if the libc is linked without our start code, the kernels
+//! built for the library's own target are used.
+//!
+//! The memory functions copy and fill with a pair of possibly overlapping
+//! blocks, one at each end, up to two vectors, a vector loop with aligned
+//! stores above that and rep movsb/stosb for large sizes on x86 CPUs that
+//! do those fast.
+const builtin = @import("builtin");
+const std = @import("std");
+const options = @import("simd_options");
+
+/// The kernels for vectors of vec_len bytes
+pub fn Kernels(comptime vec_len: usize) type {
+    return struct {
+        pub const Vec = @Vector(vec_len, u8);
+        /// One bit per byte of a block, bit 0 for the byte at the lowest address
+        pub const Mask = std.meta.Int(.unsigned, vec_len);
+        const Shift = std.math.Log2Int(Mask);
+
+        pub inline fn splat(byte: u8) Vec {
+            return [_]u8{byte} ** vec_len;
+        }
+
+        pub inline fn load(addr: usize) Vec {
+            return @as(*align(vec_len) const Vec, @ptrFromInt(addr)).*;
+        }
+
+        /// A load that can start anywhere, only call when the vec_len bytes
+        /// at p don't cross into a page the program might not have
+        pub inline fn loadUnaligned(p: [*]const u8) Vec {
+            return @as(*align(1) const Vec, @ptrCast(p)).*;
+        }
+
+        /// Whether an unaligned load at p stays in the page holding p
+        pub inline fn pageSafe(p: [*]const u8) bool {
+            return @intFromPtr(p) % std.mem.page_size <= std.mem.page_size - vec_len;
+        }
+
+        /// The mask of the bytes in v equal to byte
+        pub inline fn eqMask(v: Vec, byte: u8) Mask {
+            return toMask(v == splat(byte));
+        }
+
+        pub inline fn toMask(matches: @Vector(vec_len, bool)) Mask {
+            const mask: Mask = @bitCast(matches);
+            return if (builtin.cpu.arch.endian() == .Big) @bitReverse(mask) else mask;
+        }
+
+        fn blockStart(addr: usize) usize {
+            return addr & ~@as(usize, vec_len - 1);
+        }
+
+        /// Returns the index of the first byte in s[0..n] that matches, where
+        /// matcher.mask(block) gives the matches in a block.  n can be
+        /// maxInt(usize) when the caller knows there is a match.
+        pub inline fn scan(s: [*]const u8, n: usize, matcher: anytype) ?usize {
+            if (n == 0) return null;
+            const start = @intFromPtr(s);
+            var addr = blockStart(start);
+            var mask = matcher.mask(load(addr)) >> @as(Shift, @intCast(start - addr));
+            // index into s of bit 0 of mask
+            var offset: usize = 0;
+            while (true) {
+                if (mask != 0) {
+                    const i = offset + @ctz(mask);
+                    return if (i < n) i else null;
+                }
+                addr += vec_len;
+                offset = addr - start;
+                if (offset >= n) return null;
+                mask = matcher.mask(load(addr));
+            }
+        }
+
+        pub const ByteMatcher = struct {
+            byte: u8,
+            pub inline fn mask(self: ByteMatcher, v: Vec) Mask {
+                return eqMask(v, self.byte);
+            }
+        };
+
+        /// matches a byte or the 0 that ends the string
+        const ByteOrZeroMatcher = struct {
+            byte: u8,
+            inline fn mask(self: ByteOrZeroMatcher, v: Vec) Mask {
+                return eqMask(v, self.byte) | eqMask(v, 0);
+            }
+        };
+
+        fn strlen(s: [*:0]const u8) callconv(.C) usize {
+            return scan(s, std.math.maxInt(usize), ByteMatcher{ .byte = 0 }).?;
+        }
+
+        fn strnlen(s: [*]const u8, max_len: usize) callconv(.C) usize {
+            return scan(s, max_len, ByteMatcher{ .byte = 0 }) orelse max_len;
+        }
+
+        fn memchr(s: [*]const u8, byte: u8, n: usize) callconv(.C) ?[*]const u8 {
+            return s + (scan(s, n, ByteMatcher{ .byte = byte }) orelse return null);
+        }
+
+        fn strchr(s: [*:0]const u8, byte: u8) callconv(.C) ?[*:0]const u8 {
+            const i = scan(s, std.math.maxInt(usize), ByteOrZeroMatcher{ .byte = byte }).?;
+            return if (s[i] == byte) s + i else null;
+        }
+
+        fn strrchr(s: [*:0]const u8, byte: u8) callconv(.C) ?[*:0]const u8 {
+            const start = @intFromPtr(s);
+            var addr = blockStart(start);
+            const shift: Shift = @intCast(start - addr);
+            var v = load(addr);
+            var zeros = eqMask(v, 0) >> shift;
+            var matches = eqMask(v, byte) >> shift;
+            var offset: usize = 0;
+            var last: ?usize = null;
+            while (true) {
+                if (zeros != 0) {
+                    // only the matches up to and including the 0 count
+                    matches &= zeros ^ (zeros - 1);
+                    if (matches != 0) last = offset + (vec_len - 1 - @clz(matches));
+                    return s + (last orelse return null);
+                }
+                if (matches != 0) last = offset + (vec_len - 1 - @clz(matches));
+                addr += vec_len;
+                offset = addr - start;
+                v = load(addr);
+                zeros = eqMask(v, 0);
+                matches = eqMask(v, byte);
+            }
+        }
+
+        /// Like memchr from the end, the first block is the one holding the
+        /// last byte and the bytes before s are dropped from the last block
+        fn memrchr(s: [*]const u8, byte: u8, n: usize) callconv(.C) ?[*]const u8 {
+            if (n == 0) return null;
+            const start = @intFromPtr(s);
+            const end = start + n;
+            var addr = blockStart(end - 1);
+            var mask = eqMask(load(addr), byte);
+            const in_block = end - addr;
+            if (in_block < vec_len) mask &= (@as(Mask, 1) << @as(Shift, @intCast(in_block))) - 1;
+            while (true) {
+                if (addr < start) mask &= ~@as(Mask, 0) << @as(Shift, @intCast(start - addr));
+                if (mask != 0) return @ptrFromInt(addr + (vec_len - 1 - @clz(mask)));
+                if (addr <= start) return null;
+                addr -= vec_len;
+                mask = eqMask(load(addr), byte);
+            }
+        }
+
+        /// Matches where a span of bytes in set ends, or with reject where a
+        /// span of bytes not in set ends.  The set never holds 0, so the 0
+        /// that ends the string always matches.
+        fn SetMatcher(comptime reject: bool) type {
+            return struct {
+                set: []const u8,
+                inline fn mask(self: @This(), v: Vec) Mask {
+                    var members: Mask = 0;
+                    for (self.set) |byte| members |= eqMask(v, byte);
+                    return if (reject) members | eqMask(v, 0) else ~members;
+                }
+            };
+        }
+
+        /// strspn for a small set, one compare per byte of the set and block
+        fn span(s: [*:0]const u8, set: [*]const u8, set_len: usize) callconv(.C) usize {
+            return scan(s, std.math.maxInt(usize), SetMatcher(false){ .set = set[0..set_len] }).?;
+        }
+
+        fn cspan(s: [*:0]const u8, set: [*]const u8, set_len: usize) callconv(.C) usize {
+            return scan(s, std.math.maxInt(usize), SetMatcher(true){ .set = set[0..set_len] }).?;
+        }
+
+        /// ASCII letters to lower case
+        inline fn foldCase(v: Vec) Vec {
+            return @select(u8, v -% splat('A') < splat(26), v | splat(0x20), v);
+        }
+
+        /// Returns the first i < n where s[i] is first and s[i + gap] is
+        /// last, or n if there is none, the filter behind the substring
+        /// search.  s[0 .. n + gap] has to be readable, the loads stay
+        /// inside it.  With fold, first and last have to be lower case.
+        inline fn findPairImpl(s: [*]const u8, n: usize, first: u8, last: u8, gap: usize, comptime fold: bool) usize {
+            var i: usize = 0;
+            while (i + vec_len <= n) : (i += vec_len) {
+                const a = if (fold) foldCase(loadUnaligned(s + i)) else loadUnaligned(s + i);
+                const b = if (fold) foldCase(loadUnaligned(s + i + gap)) else loadUnaligned(s + i + gap);
+                const mask = eqMask(a, first) & eqMask(b, last);
+                if (mask != 0) return i + @ctz(mask);
+            }
+            while (i < n) : (i += 1) {
+                const a = if (fold) std.ascii.toLower(s[i]) else s[i];
+                const b = if (fold) std.ascii.toLower(s[i + gap]) else s[i + gap];
+                if (a == first and b == last) return i;
+            }
+            return n;
+        }
+
+        fn findPair(s: [*]const u8, n: usize, first: u8, last: u8, gap: usize) callconv(.C) usize {
+            return findPairImpl(s, n, first, last, gap, false);
+        }
+
+        fn findPairFolded(s: [*]const u8, n: usize, first: u8, last: u8, gap: usize) callconv(.C) usize {
+            return findPairImpl(s, n, first, last, gap, true);
+        }
+
+        /// The two strings rarely share an alignment, so this one uses
+        /// unaligned loads and falls back to a byte at a time near the end
+        /// of a page.
+        fn strcmp(a: [*:0]const u8, b: [*:0]const u8) callconv(.C) c_int {
+            var i: usize = 0;
+            while (true) {
+                if (pageSafe(a + i) and pageSafe(b + i)) {
+                    const va = loadUnaligned(a + i);
+                    const stop = toMask(va != loadUnaligned(b + i)) | eqMask(va, 0);
+                    if (stop != 0) {
+                        i += @ctz(stop);
+                        return @as(c_int, a[i]) - @as(c_int, b[i]);
+                    }
+                    i += vec_len;
+                } else {
+                    if (a[i] != b[i] or a[i] == 0) return @as(c_int, a[i]) - @as(c_int, b[i]);
+                    i += 1;
+                }
+            }
+        }
+
+        /// Blocks of 2 to 64 bytes, vectors from 16 up
+        fn Block(comptime size: usize) type {
+            return if (size >= 16) @Vector(size, u8) else std.meta.Int(.unsigned, size * 8);
+        }
+        const block_sizes = [_]usize{ 64, 32, 16, 8, 4, 2 };
+
+        inline fn read(comptime T: type, p: [*]const u8) T {
+            return @as(*align(1) const T, @ptrCast(p)).*;
+        }
+
+        inline fn write(comptime T: type, p: [*]u8, value: T) void {
+            @as(*align(1) T, @ptrCast(p)).* = value;
+        }
+
+        /// Copies n bytes, sizeOf(T) <= n <= 2 * sizeOf(T), as a T at each
+        /// end.  Both are loaded before either is stored so the memory can
+        /// overlap.
+        inline fn copyPair(comptime T: type, dest: [*]u8, src: [*]const u8, n: usize) void {
+            const head = read(T, src);
+            const tail = read(T, src + n - @sizeOf(T));
+            write(T, dest, head);
+            write(T, dest + n - @sizeOf(T), tail);
+        }
+
+        /// Copies up to 2 * vec_len bytes, the memory can overlap
+        inline fn copySmall(dest: [*]u8, src: [*]const u8, n: usize) void {
+            inline for (block_sizes) |size| {
+                if (size <= vec_len and n >= size) return copyPair(Block(size), dest, src, n);
+            }
+            if (n == 1) dest[0] = src[0];
+        }
+
+        /// Also right when dest is below an overlapping src
+        fn copyForward(dest: [*]u8, src: [*]const u8, n: usize) callconv(.C) void {
+            if (n <= 2 * vec_len) return copySmall(dest, src, n);
+            // the ends are loaded first and stored last, the loop can
+            // overwrite them when the memory overlaps
+            const head = read(Vec, src);
+            const tail = read(Vec, src + n - vec_len);
+            // the stores are aligned from here, the head covers the bytes before
+            var i = vec_len - @intFromPtr(dest) % vec_len;
+            while (i < n - vec_len) : (i += vec_len) {
+                write(Vec, dest + i, read(Vec, src + i));
+                keepLoop();
+            }
+            write(Vec, dest, head);
+            write(Vec, dest + n - vec_len, tail);
+        }
+
+        /// For dest above an overlapping src
+        fn copyBackward(dest: [*]u8, src: [*]const u8, n: usize) callconv(.C) void {
+            if (n <= 2 * vec_len) return copySmall(dest, src, n);
+            const head = read(Vec, src);
+            const tail = read(Vec, src + n - vec_len);
+            // walks down with aligned stores, the tail covers the bytes after
+            var i = n - @intFromPtr(dest + n) % vec_len;
+            while (i > vec_len) {
+                i -= vec_len;
+                write(Vec, dest + i, read(Vec, src + i));
+                keepLoop();
+            }
+            write(Vec, dest + n - vec_len, tail);
+            write(Vec, dest, head);
+        }
+
+        fn fill(dest: [*]u8, byte: u8, n: usize) callconv(.C) void {
+            if (n <= 2 * vec_len) {
+                inline for (block_sizes) |size| {
+                    if (size <= vec_len and n >= size) {
+                        const value: Block(size) = @bitCast([_]u8{byte} ** size);
+                        write(Block(size), dest, value);
+                        write(Block(size), dest + n - size, value);
+                        return;
+                    }
+                }
+                if (n == 1) dest[0] = byte;
+                return;
+            }
+            const value = splat(byte);
+            write(Vec, dest, value);
+            var i = vec_len - @intFromPtr(dest) % vec_len;
+            while (i < n - vec_len) : (i += vec_len) {
+                write(Vec, dest + i, value);
+                keepLoop();
+            }
+            write(Vec, dest + n - vec_len, value);
+        }
+
+        fn compare(a: [*]const u8, b: [*]const u8, n: usize) callconv(.C) c_int {
+            var i: usize = 0;
+            while (i + vec_len <= n) : (i += vec_len) {
+                const diff = toMask(read(Vec, a + i) != read(Vec, b + i));
+                if (diff != 0) return byteDiff(a, b, i + @ctz(diff));
+            }
+            if (i == n) return 0;
+            if (n >= vec_len) {
+                // the last block again, the bytes it shares with the one
+                // before are known to be equal
+                const last = n - vec_len;
+                const diff = toMask(read(Vec, a + last) != read(Vec, b + last));
+                return if (diff != 0) byteDiff(a, b, last + @ctz(diff)) else 0;
+            }
+            if (pageSafe(a) and pageSafe(b)) {
+                // shorter than a block, ignore the bytes past n
+                const in_range = (@as(Mask, 1) << @as(Shift, @intCast(n))) - 1;
+                const diff = toMask(read(Vec, a) != read(Vec, b)) & in_range;
+                return if (diff != 0) byteDiff(a, b, @ctz(diff)) else 0;
+            }
+            while (i < n) : (i += 1) {
+                if (a[i] != b[i]) return byteDiff(a, b, i);
+            }
+            return 0;
+        }
+
+        inline fn byteDiff(a: [*]const u8, b: [*]const u8, i: usize) c_int {
+            return @as(c_int, a[i]) - @as(c_int, b[i]);
+        }
+
+        pub const table = Table{
+            .strlen = strlen,
+            .strnlen = strnlen,
+            .memchr = memchr,
+            .strchr = strchr,
+            .strrchr = strrchr,
+            .memrchr = memrchr,
+            .findPair = findPair,
+            .findPairFolded = findPairFolded,
+            .span = span,
+            .cspan = cspan,
+            .strcmp = strcmp,
+            .copyForward = copyForward,
+            .copyBackward = copyBackward,
+            .fill = fill,
+            .compare = compare,
+        };
+    };
+}
+
+/// The kernels init can pick between, the variant objects export one each
+pub const Table = extern struct {
+    strlen: *const fn (s: [*:0]const u8) callconv(.C) usize,
+    strnlen: *const fn (s: [*]const u8, max_len: usize) callconv(.C) usize,
+    memchr: *const fn (s: [*]const u8, byte: u8, n: usize) callconv(.C) ?[*]const u8,
+    strchr: *const fn (s: [*:0]const u8, byte: u8) callconv(.C) ?[*:0]const u8,
+    strrchr: *const fn (s: [*:0]const u8, byte: u8) callconv(.C) ?[*:0]const u8,
+    memrchr: *const fn (s: [*]const u8, byte: u8, n: usize) callconv(.C) ?[*]const u8,
+    findPair: *const fn (s: [*]const u8, n: usize, first: u8, last: u8, gap: usize) callconv(.C) usize,
+    findPairFolded: *const fn (s: [*]const u8, n: usize, first: u8, last: u8, gap: usize) callconv(.C) usize,
+    span: *const fn (s: [*:0]const u8, set: [*]const u8, set_len: usize) callconv(.C) usize,
+    cspan: *const fn (s: [*:0]const u8, set: [*]const u8, set_len: usize) callconv(.C) usize,
+    strcmp: *const fn (a: [*:0]const u8, b: [*:0]const u8) callconv(.C) c_int,
+    copyForward: *const fn (dest: [*]u8, src: [*]const u8, n: usize) callconv(.C) void,
+    copyBackward: *const fn (dest: [*]u8, src: [*]const u8, n: usize) callconv(.C) void,
+    fill: *const fn (dest: [*]u8, byte: u8, n: usize) callconv(.C) void,
+    compare: *const fn (a: [*]const u8, b: [*]const u8, n: usize) callconv(.C) c_int,
+};
+
+/// LLVM turns a loop that copies or fills memory into a call to memcpy or
+/// memset, which in here would call itself.  An empty asm that touches
+/// memory keeps the loop a loop.
+inline fn keepLoop() void {
+    asm volatile ("" ::: "memory");
+}
+
+/// Above this many bytes, x86 CPUs with ERMS (fast rep movsb/stosb) copy
+/// and fill faster with a single string instruction than with a vector loop
+const rep_threshold = 2048;
+/// Set by init
+var erms = false;
+
+pub fn copy(dest: [*]u8, src: [*]const u8, n: usize) void {
+    if (builtin.cpu.arch == .x86_64 and n >= rep_threshold and erms) {
+        // rep movsb copies forward a byte at a time, which is also right for
+        // dest below an overlapping src
+        var rdi: usize = undefined;
+        var rsi: usize = undefined;
+        var rcx: usize = undefined;
+        asm volatile ("rep movsb"
+            : [_] "={rdi}" (rdi),
+              [_] "={rsi}" (rsi),
+              [_] "={rcx}" (rcx),
+            : [_] "{rdi}" (dest),
+              [_] "{rsi}" (src),
+              [_] "{rcx}" (n),
+            : "memory"
+        );
+    } else {
+        active.copyForward(dest, src, n);
+    }
+}
+
+pub fn move(dest: [*]u8, src: [*]const u8, n: usize) void {
+    // the unsigned difference is at least n unless dest starts inside src
+    if (@intFromPtr(dest) -% @intFromPtr(src) >= n) {
+        copy(dest, src, n);
+    } else {
+        active.copyBackward(dest, src, n);
+    }
+}
+
+pub fn set(dest: [*]u8, byte: u8, n: usize) void {
+    if (builtin.cpu.arch == .x86_64 and n >= rep_threshold and erms) {
+        var rdi: usize = undefined;
+        var rcx: usize = undefined;
+        asm volatile ("rep stosb"
+            : [_] "={rdi}" (rdi),
+              [_] "={rcx}" (rcx),
+            : [_] "{rdi}" (dest),
+              [_] "{al}" (byte),
+              [_] "{rcx}" (n),
+            : "memory"
+        );
+    } else {
+        active.fill(dest, byte, n);
+    }
+}
+
+/// Bytes per block for the library's own target
+pub const vec_len = std.simd.suggestVectorSize(u8) orelse 16;
+pub const native = Kernels(vec_len);
+
+/// Set once by init, before main and any other thread runs
+pub var active: *const Table = &native.table;
+
+const variants = struct {
+    extern const __zsimd_avx2: Table;
+    extern const __zsimd_avx512: Table;
+};
+
+/// Picks the kernels for the CPU the program runs on
+pub fn init() void {
+    if (builtin.cpu.arch != .x86_64 or !options.variants) return;
+    const features = x86.detect();
+    erms = features.erms;
+    if (features.avx512) {
+        active = &variants.__zsimd_avx512;
+    } else if (features.avx2) {
+        active = &variants.__zsimd_avx2;
+    }
+}
+
+const x86 = struct {
+    const Regs = struct { eax: u32, ebx: u32, ecx: u32, edx: u32 };
+
+    fn cpuid(leaf: u32, subleaf: u32) Regs {
+        var eax: u32 = undefined;
+        var ebx: u32 = undefined;
+        var ecx: u32 = undefined;
+        var edx: u32 = undefined;
+        asm volatile ("cpuid"
+            : [_] "={eax}" (eax),
+              [_] "={ebx}" (ebx),
+              [_] "={ecx}" (ecx),
+              [_] "={edx}" (edx),
+            : [_] "{eax}" (leaf),
+              [_] "{ecx}" (subleaf),
+        );
+        return .{ .eax = eax, .ebx = ebx, .ecx = ecx, .edx = edx };
+    }
+
+    /// The register state the OS saves on a context switch
+    fn xcr0() u32 {
+        return asm volatile ("xgetbv"
+            : [_] "={eax}" (-> u32),
+            : [_] "{ecx}" (@as(u32, 0)),
+            : "edx"
+        );
+    }
+
+    fn bit(value: u32, comptime index: u5) bool {
+        return value & (1 << index) != 0;
+    }
+
+    const Features = struct { avx2: bool = false, avx512: bool = false, erms: bool = false };
+
+    /// The variants need their vector instructions and BMI1/BMI2, which
+    /// they're built with, and the OS has to save the wider registers.
+    fn detect() Features {
+        var result = Features{};
+        if (cpuid(0, 0).eax < 7) return result;
+        const leaf7 = cpuid(7, 0);
+        result.erms = bit(leaf7.ebx, 9);
+        const leaf1 = cpuid(1, 0);
+        // OSXSAVE and AVX
+        if (!bit(leaf1.ecx, 27) or !bit(leaf1.ecx, 28)) return result;
+        const state = xcr0();
+        // XMM and YMM state
+        if (state & 0x6 != 0x6) return result;
+        // BMI1, AVX2 and BMI2
+        if (!bit(leaf7.ebx, 3) or !bit(leaf7.ebx, 5) or !bit(leaf7.ebx, 8)) return result;
+        result.avx2 = true;
+        // AVX512F and AVX512BW, and the opmask and ZMM state
+        result.avx512 = bit(leaf7.ebx, 16) and bit(leaf7.ebx, 30) and state & 0xe0 == 0xe0;
+        return result;
+    }
+};
@@ -0,0 +1,10 @@
+//! The root of the objects that build the simd.zig kernels again for
+//! wider x86 vectors, ziglibcbuild.zig sets the CPU features and the
+//! options.  Each one exports its table for simd.init to pick.
+const simd = @import("simd.zig");
+const variant = @import("simd_variant");
+
+const table = simd.Kernels(variant.vec_len).table;
+comptime {
+    @export(table, .{ .name = "__zsimd_" ++ variant.name });
+}
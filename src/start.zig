@@ -3,9 +3,12 @@ const std = @import("std");
 
 const c = struct {
     extern fn main(argc: c_int, argv: [*:null]?[*:0]u8) callconv(.C) c_int;
+    extern fn exit(status: c_int) callconv(.C) noreturn;
+    extern fn __zinit() callconv(.C) void;
 };
 
-pub fn main() u8 {
+pub fn main() noreturn {
+    c.__zinit();
     var argc: c_int = undefined;
     const args: [*:null]?[*:0]u8 = blk: {
         if (builtin.os.tag == .windows) {
@@ -21,7 +24,8 @@ pub fn main() u8 {
     if (result != 0) {
         while ((result & 0xff == 0)) result = result >> 8;
     }
-    return @as(u8, @intCast(result & 0xff));
+    // returning from main is the same as calling exit, this runs the atexit handlers
+    c.exit(result & 0xff);
 }
 
 // TODO: I'm pretty sure this could be more memory efficient
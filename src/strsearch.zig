@@ -0,0 +1,136 @@
+//! Substring search behind strstr, strcasestr and memmem.
+//!
+//! Needles up to short_max bytes go through a vector filter on their first
+//! and last bytes (see findPair in simd.zig) and every candidate it finds is
+//! compared in full, so a haystack byte costs at most short_max compares.
+//! Longer needles use the Two-Way algorithm of Crochemore and Perrin, linear
+//! time with constant space.  With fold, ASCII letters match either case.
+const std = @import("std");
+const simd = @import("simd.zig");
+
+const short_max = 32;
+
+/// Returns the index of the first needle in hay
+pub fn find(hay: []const u8, needle: []const u8, comptime fold: bool) ?usize {
+    if (needle.len == 0) return 0;
+    if (hay.len < needle.len) return null;
+    if (needle.len <= short_max) return findShort(hay, needle, fold);
+    return twoWay(hay, needle, fold);
+}
+
+inline fn at(s: []const u8, i: usize, comptime fold: bool) u8 {
+    return if (fold) std.ascii.toLower(s[i]) else s[i];
+}
+
+fn eql(a: []const u8, b: []const u8, comptime fold: bool) bool {
+    if (!fold) return std.mem.eql(u8, a, b);
+    for (a, b) |x, y| {
+        if (std.ascii.toLower(x) != std.ascii.toLower(y)) return false;
+    }
+    return true;
+}
+
+fn findShort(hay: []const u8, needle: []const u8, comptime fold: bool) ?usize {
+    const gap = needle.len - 1;
+    const first = at(needle, 0, fold);
+    const last = at(needle, gap, fold);
+    const findPair = if (fold) simd.active.findPairFolded else simd.active.findPair;
+    // the positions a match can start at
+    const n = hay.len - gap;
+    var i: usize = 0;
+    while (true) : (i += 1) {
+        i += findPair(hay.ptr + i, n - i, first, last, gap);
+        if (i == n) return null;
+        if (gap == 0 or eql(hay[i + 1 .. i + gap], needle[1..gap], fold)) return i;
+    }
+}
+
+const Factorization = struct {
+    /// the needle splits into needle[0..suffix] and needle[suffix..]
+    suffix: usize,
+    period: usize,
+};
+
+/// The start of the maximal suffix of the needle and its period, by the
+/// byte order or the reverse of it
+fn maximalSuffix(needle: []const u8, comptime reverse: bool, comptime fold: bool) Factorization {
+    // the start of the suffix less one, wraps around for the whole needle
+    var max_suffix: usize = std.math.maxInt(usize);
+    var j: usize = 0;
+    var k: usize = 1;
+    var period: usize = 1;
+    while (j + k < needle.len) {
+        const a = at(needle, j + k, fold);
+        const b = at(needle, max_suffix +% k, fold);
+        if (if (reverse) b < a else a < b) {
+            j += k;
+            k = 1;
+            period = j -% max_suffix;
+        } else if (a == b) {
+            if (k != period) {
+                k += 1;
+            } else {
+                j += period;
+                k = 1;
+            }
+        } else {
+            max_suffix = j;
+            j += 1;
+            k = 1;
+            period = 1;
+        }
+    }
+    return .{ .suffix = max_suffix +% 1, .period = period };
+}
+
+/// The later of the two maximal suffixes is a critical factorization
+fn criticalFactorization(needle: []const u8, comptime fold: bool) Factorization {
+    const forward = maximalSuffix(needle, false, fold);
+    const reverse = maximalSuffix(needle, true, fold);
+    return if (reverse.suffix < forward.suffix) forward else reverse;
+}
+
+fn twoWay(hay: []const u8, needle: []const u8, comptime fold: bool) ?usize {
+    const m = needle.len;
+    const factorization = criticalFactorization(needle, fold);
+    const suffix = factorization.suffix;
+    var j: usize = 0;
+    if (eql(needle[0..suffix], needle[factorization.period..][0..suffix], fold)) {
+        // the needle is periodic, after a mismatch in the left half the
+        // bytes of the last period are known to match
+        const period = factorization.period;
+        var memory: usize = 0;
+        while (j <= hay.len - m) {
+            var i = @max(suffix, memory);
+            while (i < m and at(needle, i, fold) == at(hay, i + j, fold)) i += 1;
+            if (i < m) {
+                j += i - suffix + 1;
+                memory = 0;
+                continue;
+            }
+            // the right half matches, compare the left half backwards
+            i = suffix;
+            while (i > memory and at(needle, i - 1, fold) == at(hay, i - 1 + j, fold)) i -= 1;
+            if (i <= memory) return j;
+            j += period;
+            memory = m - period;
+        }
+    } else {
+        // no period to remember, a mismatch in the left half shifts past
+        // the longer half
+        const shift = @max(suffix, m - suffix) + 1;
+        while (j <= hay.len - m) {
+            var i = suffix;
+            while (i < m and at(needle, i, fold) == at(hay, i + j, fold)) i += 1;
+            if (i < m) {
+                j += i - suffix + 1;
+                continue;
+            }
+            i = suffix;
+            while (i > 0 and at(needle, i - 1, fold) == at(hay, i - 1 + j, fold)) i -= 1;
+            if (i == 0) return j;
+            j += shift;
+        }
+    }
+    return null;
+}
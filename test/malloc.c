@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <malloc.h>
+#include <pthread.h>
+
+#include "expect.h"
+
+static int all_equal(const unsigned char *p, size_t len, unsigned char value)
+{
+  for (size_t i = 0; i < len; i++) {
+    if (p[i] != value) return 0;
+  }
+  return 1;
+}
+
+enum { handoff_count = 30000, handoff_size = 64 };
+static unsigned char *handoff[handoff_count];
+
+static void *free_handoff(void *arg)
+{
+  for (int i = 0; i < handoff_count; i++) {
+    expect(all_equal(handoff[i], handoff_size, (unsigned char)(size_t)arg));
+    free(handoff[i]);
+  }
+  return arg;
+}
+
+enum { exiting_count = 5000, exiting_size = 100 };
+static unsigned char *kept[exiting_count];
+
+// allocates on its own heap and leaves half of the blocks for main to free
+static void *alloc_and_exit(void *arg)
+{
+  (void)arg;
+  unsigned char *freed[exiting_count];
+  for (int i = 0; i < exiting_count; i++) {
+    freed[i] = malloc(exiting_size);
+    kept[i] = malloc(exiting_size);
+    expect(freed[i] != NULL && kept[i] != NULL);
+    memset(kept[i], 0x77, exiting_size);
+  }
+  for (int i = 0; i < exiting_count; i++) free(freed[i]);
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  // the backend that reuses freed memory, the others only pass the basics
+  const int fast_backend = (argc > 1 && 0 == strcmp(argv[1], "fast"));
+
+  // every size class plus a few sizes that get their own mapping
+  for (size_t size = 1; size <= 600 * 1024; size += (size < 1024) ? 1 : size / 8) {
+    unsigned char *p = malloc(size);
+    expect(p != NULL);
+    expect(((size_t)p & 15) == 0);
+    memset(p, 0xab, size);
+
+    p = realloc(p, size * 2);
+    expect(p != NULL);
+    expect(all_equal(p, size, 0xab));
+
+    p = realloc(p, size / 2 + 1);
+    expect(p != NULL);
+    expect(all_equal(p, size / 2 + 1, 0xab));
+    free(p);
+  }
+
+  // enough small blocks to fill many pages, freed in a different order
+  {
+    enum { count = 20000 };
+    static unsigned char *ptrs[count];
+    for (int i = 0; i < count; i++) {
+      ptrs[i] = malloc(24 + (i % 7) * 8);
+      expect(ptrs[i] != NULL);
+      memset(ptrs[i], i & 0xff, 24);
+    }
+    for (int i = 0; i < count; i += 2) {
+      expect(all_equal(ptrs[i], 24, i & 0xff));
+      free(ptrs[i]);
+    }
+    for (int i = 1; i < count; i += 2) {
+      expect(all_equal(ptrs[i], 24, i & 0xff));
+      free(ptrs[i]);
+    }
+  }
+
+  // grow a large buffer step by step, these blocks are moved by remapping
+  {
+    size_t size = 200 * 1024;
+    unsigned char *p = malloc(size);
+    expect(p != NULL);
+    memset(p, 0x5a, size);
+    while (size < 16 * 1024 * 1024) {
+      size_t new_size = size + size / 2;
+      p = realloc(p, new_size);
+      expect(p != NULL);
+      expect(all_equal(p, size, 0x5a));
+      memset(p + size, 0x5a, new_size - size);
+      size = new_size;
+    }
+    p = realloc(p, 300 * 1024);
+    expect(p != NULL);
+    expect(all_equal(p, 300 * 1024, 0x5a));
+    free(p);
+  }
+
+  {
+    unsigned char *p = calloc(1000, 100);
+    expect(p != NULL);
+    expect(all_equal(p, 1000 * 100, 0));
+    free(p);
+  }
+  // calloc has to clear blocks that are reused
+  for (size_t size = 16; size <= 64 * 1024; size *= 2) {
+    unsigned char *ptrs[8];
+    for (int i = 0; i < 8; i++) {
+      ptrs[i] = malloc(size);
+      expect(ptrs[i] != NULL);
+      memset(ptrs[i], 0xff, size);
+    }
+    for (int i = 0; i < 8; i++) free(ptrs[i]);
+    for (int i = 0; i < 8; i++) {
+      ptrs[i] = calloc(1, size);
+      expect(ptrs[i] != NULL);
+      expect(all_equal(ptrs[i], size, 0));
+    }
+    for (int i = 0; i < 8; i++) free(ptrs[i]);
+  }
+  expect(NULL == calloc((size_t)-1 / 2, 4));
+
+  // aligned blocks
+  for (size_t alignment = 32; alignment <= 1024 * 1024; alignment *= 2) {
+    static const size_t sizes[] = { 1, 24, 100, 4096, 50000, 200000 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+      unsigned char *p = aligned_alloc(alignment, sizes[i]);
+      expect(p != NULL);
+      expect(((size_t)p & (alignment - 1)) == 0);
+      expect(malloc_usable_size(p) >= sizes[i]);
+      memset(p, 0x33, sizes[i]);
+      free(p);
+
+      void *q = NULL;
+      expect(0 == posix_memalign(&q, alignment, sizes[i]));
+      expect(((size_t)q & (alignment - 1)) == 0);
+      free(q);
+    }
+  }
+  {
+    // these should come from a size class that's a multiple of the alignment
+    unsigned char *p = memalign(64, 100);
+    expect(p != NULL);
+    expect(((size_t)p & 63) == 0);
+    expect(malloc_usable_size(p) < 256);
+    p = realloc(p, 1000);
+    expect(p != NULL);
+    free(p);
+
+    p = valloc(10);
+    expect(p != NULL);
+    expect(((size_t)p & 4095) == 0);
+    free(p);
+    p = pvalloc(10);
+    expect(p != NULL);
+    expect(((size_t)p & 4095) == 0);
+    expect(malloc_usable_size(p) >= 4096);
+    free(p);
+
+    void *q = NULL;
+    expect(EINVAL == posix_memalign(&q, 24, 100));
+    expect(NULL == aligned_alloc(3, 100));
+  }
+
+  // introspection
+  {
+    struct mallinfo2 before = mallinfo2();
+    unsigned char *small = malloc(100);
+    unsigned char *huge = malloc(1024 * 1024);
+    expect(small != NULL && huge != NULL);
+    expect(malloc_usable_size(small) >= 100);
+    expect(malloc_usable_size(huge) >= 1024 * 1024);
+    expect(malloc_usable_size(NULL) == 0);
+    struct mallinfo2 after = mallinfo2();
+    // the debug allocator doesn't keep stats
+    const int have_stats = (after.arena != 0);
+    if (have_stats) {
+      expect(after.uordblks >= before.uordblks + 100);
+      expect(after.hblks == before.hblks + 1);
+      expect(after.hblkhd >= before.hblkhd + 1024 * 1024);
+    }
+    free(huge);
+    free(small);
+    after = mallinfo2();
+    if (have_stats) {
+      expect(after.hblks == before.hblks);
+    }
+    malloc_trim(0);
+  }
+
+  // one thread allocates and another frees, most of the pages are full when
+  // their blocks are freed, the allocating thread has to get them back
+  {
+    const size_t baseline = mallinfo2().uordblks;
+    size_t arena_after_first = 0;
+    for (int round = 0; round < 8; round++) {
+      for (int i = 0; i < handoff_count; i++) {
+        handoff[i] = malloc(handoff_size);
+        expect(handoff[i] != NULL);
+        memset(handoff[i], round, handoff_size);
+      }
+      if (fast_backend) {
+        // blocks freed in the last round that haven't been collected yet
+        // are still counted, at most a page's worth
+        const size_t in_use = mallinfo2().uordblks - baseline;
+        expect(in_use >= handoff_count * handoff_size);
+        expect(in_use <= handoff_count * handoff_size + 256 * 1024);
+      }
+      pthread_t thread;
+      expect(0 == pthread_create(&thread, NULL, free_handoff, (void *)(size_t)round));
+      void *result = NULL;
+      expect(0 == pthread_join(thread, &result));
+      expect(result == (void *)(size_t)round);
+      if (round == 0) arena_after_first = mallinfo2().arena;
+    }
+    // every round would need another 2 MB if the blocks weren't reused
+    if (fast_backend) expect(mallinfo2().arena <= arena_after_first);
+  }
+
+  // the heaps of threads that exit are adopted by the next ones, with the
+  // blocks freed into them after their thread was gone
+  {
+    size_t arena_after_first = 0;
+    for (int round = 0; round < 16; round++) {
+      pthread_t thread;
+      expect(0 == pthread_create(&thread, NULL, alloc_and_exit, NULL));
+      expect(0 == pthread_join(thread, NULL));
+      for (int i = 0; i < exiting_count; i++) {
+        expect(all_equal(kept[i], exiting_size, 0x77));
+        free(kept[i]);
+      }
+      if (round == 0) arena_after_first = mallinfo2().arena;
+    }
+    if (fast_backend) {
+      struct mallinfo2 info = mallinfo2();
+      expect(info.arena <= arena_after_first);
+      expect(info.uordblks <= info.arena);
+    }
+  }
+
+  free(NULL);
+  expect(NULL == realloc(malloc(10), 0));
+
+  puts("Success!");
+  return 0;
+}
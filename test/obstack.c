@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <obstack.h>
+
+#include "expect.h"
+
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
+
+int main(int argc, char *argv[])
+{
+  struct obstack ob;
+  expect(obstack_init(&ob));
+
+  // many small objects that die together, enough to need several chunks
+  char *mark = obstack_alloc(&ob, 0);
+  char *strings[1000];
+  for (int i = 0; i < 1000; i++) {
+    char buf[32];
+    int len = sprintf(buf, "string %d", i);
+    strings[i] = obstack_copy0(&ob, buf, len);
+    expect(((size_t)strings[i] & 15) == 0);
+  }
+  for (int i = 0; i < 1000; i++) {
+    char buf[32];
+    sprintf(buf, "string %d", i);
+    expect(0 == strcmp(strings[i], buf));
+  }
+  expect(obstack_memory_used(&ob) > 4096);
+
+  // grow an object a byte at a time across chunk boundaries
+  for (int i = 0; i < 10000; i++) {
+    obstack_1grow(&ob, 'a' + (i % 26));
+  }
+  expect(obstack_object_size(&ob) == 10000);
+  char *grown = obstack_finish(&ob);
+  for (int i = 0; i < 10000; i++) {
+    expect(grown[i] == 'a' + (i % 26));
+  }
+
+  obstack_grow(&ob, "hello ", 6);
+  obstack_grow0(&ob, "world", 5);
+  expect(0 == strcmp(obstack_finish(&ob), "hello world"));
+
+  int *ints = obstack_alloc(&ob, 100 * sizeof(int));
+  for (int i = 0; i < 100; i++) ints[i] = i;
+  expect(((size_t)ints & 15) == 0);
+
+  // free everything after the mark, the obstack is still usable
+  obstack_free(&ob, mark);
+  expect(obstack_object_size(&ob) == 0);
+  char *again = obstack_copy0(&ob, "again", 5);
+  expect(0 == strcmp(again, "again"));
+
+  // free it all
+  obstack_free(&ob, NULL);
+  expect(obstack_init(&ob));
+  obstack_free(&ob, NULL);
+
+  puts("Success!");
+  return 0;
+}
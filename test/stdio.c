@@ -0,0 +1,666 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "expect.h"
+
+static size_t readFile(const char *filename, char *buf, size_t size)
+{
+  FILE *file = fopen(filename, "r");
+  expect(file != NULL);
+  size_t len = fread(buf, 1, size, file);
+  expect(0 == fclose(file));
+  return len;
+}
+
+enum { writer_lines = 3000, writer_line_len = 40 };
+
+struct writer {
+  FILE *file;
+  char letter;
+};
+
+// writes whole lines of one letter, going through each of the write paths
+static void *write_lines(void *arg)
+{
+  const struct writer *writer = arg;
+  char line[writer_line_len + 1];
+  memset(line, writer->letter, writer_line_len - 1);
+  line[writer_line_len - 1] = '\n';
+  line[writer_line_len] = 0;
+  for (int i = 0; i < writer_lines; i++) {
+    switch (i % 4) {
+    case 0:
+      expect(1 == fwrite(line, writer_line_len, 1, writer->file));
+      break;
+    case 1:
+      expect(0 <= fputs(line, writer->file));
+      break;
+    case 2:
+      expect(writer_line_len == fprintf(writer->file, "%s", line));
+      break;
+    case 3:
+      // a line put together from several calls under one lock
+      flockfile(writer->file);
+      for (int j = 0; j < writer_line_len; j++) {
+        expect((unsigned char)line[j] == putc_unlocked(line[j], writer->file));
+      }
+      funlockfile(writer->file);
+      break;
+    }
+  }
+  return NULL;
+}
+
+// every line must be whole and the count of each letter must match
+static void check_lines(const char *filename, int a_lines, int b_lines)
+{
+  FILE *file = fopen(filename, "r");
+  expect(file != NULL);
+  char line[100];
+  int counts[2] = { 0, 0 };
+  while (fgets(line, sizeof(line), file)) {
+    expect(strlen(line) == writer_line_len);
+    expect(line[0] == 'a' || line[0] == 'b');
+    for (int j = 0; j < writer_line_len - 1; j++) {
+      expect(line[j] == line[0]);
+    }
+    counts[line[0] - 'a']++;
+  }
+  expect(counts[0] == a_lines && counts[1] == b_lines);
+  expect(0 == fclose(file));
+}
+
+static int writer_started;
+static int writer_done;
+
+static void *write_lines_and_finish(void *arg)
+{
+  write_lines(arg);
+  __atomic_store_n(&writer_done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static void *start_and_write_lines(void *arg)
+{
+  __atomic_store_n(&writer_started, 1, __ATOMIC_RELEASE);
+  return write_lines(arg);
+}
+
+enum { reopen_count = 2000 };
+
+// opens and closes streams so their slots keep getting reused
+static void *reopen_files(void *arg)
+{
+  const char *filename = arg;
+  for (int i = 0; i < reopen_count; i++) {
+    FILE *file = fopen(filename, "w");
+    expect(file != NULL);
+    expect('x' == fputc('x', file));
+    expect(0 == fclose(file));
+  }
+  return NULL;
+}
+
+// CWD should be a directory available to create files
+int main(int argc, char *argv[])
+{
+  char buf[BUFSIZ * 4];
+
+  {
+    FILE *file = fopen("buffered", "w");
+    expect(file != NULL);
+    for (int i = 0; i < 100; i++) {
+      expect('a' == fputc('a', file));
+    }
+    for (int i = 0; i < 10; i++) {
+      expect(1 == fwrite("0123456789", 10, 1, file));
+    }
+    expect(4 == fprintf(file, "%d\n", 123));
+    // the output is still in the stream buffer
+    expect(0 == readFile("buffered", buf, sizeof(buf)));
+    expect(0 == fflush(file));
+    expect(204 == readFile("buffered", buf, sizeof(buf)));
+    expect(buf[0] == 'a' && buf[99] == 'a' && buf[100] == '0' && buf[199] == '9');
+    expect(0 == memcmp(buf + 200, "123\n", 4));
+    // larger than the buffer, written through
+    memset(buf, 'x', sizeof(buf));
+    expect(sizeof(buf) == fwrite(buf, 1, sizeof(buf), file));
+    expect(0 == fclose(file));
+    static char contents[BUFSIZ * 5];
+    expect(204 + sizeof(buf) == readFile("buffered", contents, sizeof(contents)));
+    expect(contents[203] == '\n' && contents[204] == 'x' && contents[203 + sizeof(buf)] == 'x');
+  }
+
+  {
+    FILE *file = fopen("unbuffered", "w");
+    expect(file != NULL);
+    expect(0 == setvbuf(file, NULL, _IONBF, 0));
+    expect(5 == fwrite("hello", 1, 5, file));
+    expect(5 == readFile("unbuffered", buf, sizeof(buf)));
+    expect(0 == fclose(file));
+  }
+
+  {
+    FILE *file = fopen("linebuffered", "w");
+    expect(file != NULL);
+    expect(0 == setvbuf(file, NULL, _IOLBF, 64));
+    expect(6 == fprintf(file, "line 1"));
+    expect(0 == readFile("linebuffered", buf, sizeof(buf)));
+    expect('\n' == fputc('\n', file));
+    expect(7 == readFile("linebuffered", buf, sizeof(buf)));
+    expect(0 == memcmp(buf, "line 1\n", 7));
+    expect(0 == fclose(file));
+  }
+
+  {
+    static char user_buf[BUFSIZ];
+    FILE *file = fopen("setbuf", "w");
+    expect(file != NULL);
+    setbuf(file, user_buf);
+    expect(3 == fwrite("abc", 1, 3, file));
+    expect(0 == memcmp(user_buf, "abc", 3));
+    expect(0 == readFile("setbuf", buf, sizeof(buf)));
+    expect(0 == fclose(file));
+    expect(3 == readFile("setbuf", buf, sizeof(buf)));
+  }
+
+  {
+    FILE *file = fopen("badmode", "w");
+    expect(file != NULL);
+    expect(0 != setvbuf(file, NULL, 42, 0));
+    expect(0 == fclose(file));
+  }
+
+  // fflush(NULL) flushes every stream
+  {
+    FILE *file = fopen("flushall", "w");
+    expect(file != NULL);
+    expect('z' == fputc('z', file));
+    expect(0 == fflush(NULL));
+    expect(1 == readFile("flushall", buf, sizeof(buf)));
+    expect(0 == fclose(file));
+  }
+
+  {
+    FILE *file = fopen("lines", "w");
+    expect(file != NULL);
+    for (int i = 0; i < 1000; i++) {
+      expect(0 < fprintf(file, "line %d\n", i));
+    }
+    expect(4 == fwrite("tail", 1, 4, file));
+    expect(0 == fclose(file));
+
+    file = fopen("lines", "r");
+    expect(file != NULL);
+    expect('l' == getc(file));
+    expect('l' == ungetc('l', file));
+    expect('l' == fgetc(file));
+    expect('X' == ungetc('X', file));
+    char line[100];
+    expect(line == fgets(line, sizeof(line), file));
+    expect(0 == strcmp(line, "Xine 0\n"));
+    // the line doesn't fit, it comes back in pieces
+    expect(line == fgets(line, 4, file));
+    expect(0 == strcmp(line, "lin"));
+    expect(line == fgets(line, sizeof(line), file));
+    expect(0 == strcmp(line, "e 1\n"));
+    for (int i = 2; i < 1000; i++) {
+      char expected[100];
+      sprintf(expected, "line %d\n", i);
+      expect(line == fgets(line, sizeof(line), file));
+      expect(0 == strcmp(line, expected));
+    }
+    expect(line == fgets(line, sizeof(line), file));
+    expect(0 == strcmp(line, "tail"));
+    expect(NULL == fgets(line, sizeof(line), file));
+    expect(feof(file));
+    expect(EOF == getc(file));
+    clearerr(file);
+    expect(!feof(file));
+    expect('!' == ungetc('!', file));
+    expect('!' == getc(file));
+    expect(EOF == getc(file));
+    expect(0 == fclose(file));
+  }
+
+  {
+    FILE *file = fopen("records", "w");
+    expect(file != NULL);
+    expect(7 == fwrite("abcdefg", 1, 7, file));
+    expect(0 == fclose(file));
+
+    file = fopen("records", "r");
+    expect(file != NULL);
+    char record[8];
+    expect('a' == getc(file));
+    expect(3 == fread(record, 2, 4, file));
+    expect(0 == memcmp(record, "bcdefg", 6));
+    expect(0 == fread(record, 2, 1, file));
+    expect(feof(file));
+    expect(0 == fclose(file));
+  }
+
+  {
+    FILE *file = fopen("getline", "w");
+    expect(file != NULL);
+    expect(6 == fwrite("short\n", 1, 6, file));
+    for (int i = 0; i < 20000; i++) {
+      expect('a' + i % 26 == fputc('a' + i % 26, file));
+    }
+    expect(11 == fwrite("\na,b,,c\nend", 1, 11, file));
+    expect(0 == fclose(file));
+
+    file = fopen("getline", "r");
+    expect(file != NULL);
+    char *line = NULL;
+    size_t size = 0;
+    expect(6 == getline(&line, &size, file));
+    expect(0 == strcmp(line, "short\n"));
+    expect(size >= 7);
+    expect(20001 == getline(&line, &size, file));
+    expect(size > 20001);
+    expect(line[0] == 'a' && line[19999] == 'a' + 19999 % 26 && line[20000] == '\n' && line[20001] == 0);
+    expect(2 == getdelim(&line, &size, ',', file));
+    expect(0 == strcmp(line, "a,"));
+    expect(2 == getdelim(&line, &size, ',', file));
+    expect(1 == getdelim(&line, &size, ',', file));
+    expect(0 == strcmp(line, ","));
+    expect(2 == getline(&line, &size, file));
+    expect(0 == strcmp(line, "c\n"));
+    expect(3 == getline(&line, &size, file));
+    expect(0 == strcmp(line, "end"));
+    expect(-1 == getline(&line, &size, file));
+    expect(feof(file));
+    free(line);
+    expect(0 == fclose(file));
+  }
+
+  // more streams than fit in the first pages of the pool
+  {
+    enum { count = 300 };
+    static FILE *files[count];
+    for (int round = 0; round < 2; round++) {
+      for (int i = 0; i < count; i++) {
+        char name[20];
+        sprintf(name, "many%d", i);
+        files[i] = fopen(name, "w");
+        expect(files[i] != NULL);
+        for (int j = 0; j < i; j++) {
+          expect(files[i] != files[j]);
+        }
+        expect(files[i] != stdin && files[i] != stdout && files[i] != stderr);
+        expect(1 == fwrite(name, 1, 1, files[i]));
+      }
+      for (int i = 0; i < count; i++) {
+        expect(0 == fclose(files[i]));
+      }
+    }
+  }
+
+  {
+    FILE *file = fopen("unlocked", "w");
+    expect(file != NULL);
+    flockfile(file);
+    expect(0 == ftrylockfile(file));
+    for (int i = 0; i < 26; i++) {
+      expect('a' + i == putc_unlocked('a' + i, file));
+    }
+    expect('\n' == fputc_unlocked('\n', file));
+    expect(1 == fwrite_unlocked("0123456789", 10, 1, file));
+    expect(0 <= fputs_unlocked("\n", file));
+    expect(0 == fflush_unlocked(file));
+    funlockfile(file);
+    // the locked functions still work while this thread holds the lock
+    expect(4 == fprintf(file, "end\n"));
+    funlockfile(file);
+    expect(0 == fclose(file));
+
+    file = fopen("unlocked", "r");
+    expect(file != NULL);
+    flockfile(file);
+    expect('a' == getc_unlocked(file));
+    expect('b' == fgetc_unlocked(file));
+    char line[100];
+    expect(line == fgets_unlocked(line, sizeof(line), file));
+    expect(0 == strcmp(line, "cdefghijklmnopqrstuvwxyz\n"));
+    expect(5 == fread_unlocked(line, 2, 5, file));
+    expect(0 == memcmp(line, "0123456789", 10));
+    funlockfile(file);
+    expect(line == fgets(line, sizeof(line), file));
+    expect(0 == strcmp(line, "\n"));
+    expect(line == fgets(line, sizeof(line), file));
+    expect(0 == strcmp(line, "end\n"));
+    expect(0 == fclose(file));
+  }
+
+  {
+    // a lock taken while the program is single-threaded still holds after
+    // it starts a thread
+    FILE *file = fopen("locked.txt", "w");
+    expect(file != NULL);
+    flockfile(file);
+    struct writer a = { file, 'a' };
+    pthread_t thread;
+    expect(0 == pthread_create(&thread, NULL, start_and_write_lines, &a));
+    while (!__atomic_load_n(&writer_started, __ATOMIC_ACQUIRE)) { }
+    for (int i = 0; i < 100; i++) {
+      expect('b' == putc_unlocked('b', file));
+    }
+    funlockfile(file);
+    expect(0 == pthread_join(thread, NULL));
+    expect(0 == fclose(file));
+    char buf[101];
+    expect(sizeof(buf) == readFile("locked.txt", buf, sizeof(buf)));
+    for (int i = 0; i < 100; i++) {
+      expect(buf[i] == 'b');
+    }
+    expect(buf[100] == 'a');
+  }
+
+  {
+    // two threads write lines to the same stream, the lines must come out
+    // whole and every one of them must be there
+    FILE *file = fopen("threads.txt", "w");
+    expect(file != NULL);
+    struct writer a = { file, 'a' }, b = { file, 'b' };
+    pthread_t thread;
+    expect(0 == pthread_create(&thread, NULL, write_lines, &a));
+    write_lines(&b);
+    expect(0 == pthread_join(thread, NULL));
+    expect(0 == fclose(file));
+    check_lines("threads.txt", writer_lines, writer_lines);
+  }
+
+  {
+    // reading flushes stdout when it's line buffered, while another thread
+    // is writing to it
+    FILE *input = fopen("input.txt", "w+");
+    expect(input != NULL);
+    for (int i = 0; i < 1000; i++) {
+      expect('i' == putc('i', input));
+    }
+    expect(0 == setvbuf(input, NULL, _IOFBF, 16));
+
+    expect(0 == fflush(stdout));
+    int saved_stdout = dup(1);
+    expect(saved_stdout != -1);
+    FILE *output = fopen("stdout.txt", "w");
+    expect(output != NULL);
+    expect(1 == dup2(fileno(output), 1));
+    expect(0 == setvbuf(stdout, NULL, _IOLBF, BUFSIZ));
+
+    struct writer a = { stdout, 'a' };
+    pthread_t thread;
+    expect(0 == pthread_create(&thread, NULL, write_lines_and_finish, &a));
+    while (!__atomic_load_n(&writer_done, __ATOMIC_ACQUIRE)) {
+      rewind(input);
+      while (EOF != getc(input)) { }
+    }
+    expect(0 == pthread_join(thread, NULL));
+
+    expect(0 == fflush(stdout));
+    expect(1 == dup2(saved_stdout, 1));
+    expect(0 == close(saved_stdout));
+    expect(0 == fclose(output));
+    expect(0 == fclose(input));
+    check_lines("stdout.txt", writer_lines, 0);
+  }
+
+  {
+    // flushing every stream while other threads close streams and open
+    // new ones in the same slots
+    pthread_t threads[2];
+    expect(0 == pthread_create(&threads[0], NULL, reopen_files, "reopen1.txt"));
+    expect(0 == pthread_create(&threads[1], NULL, reopen_files, "reopen2.txt"));
+    for (int i = 0; i < reopen_count; i++) {
+      expect(0 == fflush(NULL));
+    }
+    expect(0 == pthread_join(threads[0], NULL));
+    expect(0 == pthread_join(threads[1], NULL));
+  }
+
+  {
+    FILE *file = fopen("fputs", "w");
+    expect(file != NULL);
+    expect(0 <= fputs("abc", file));
+    expect(0 <= fputs("", file));
+    expect(0 <= fputs("def\n", file));
+    expect(0 == fclose(file));
+    expect(7 == readFile("fputs", buf, sizeof(buf)));
+    expect(0 == memcmp(buf, "abcdef\n", 7));
+  }
+
+  {
+    char mem[16] = "hello";
+    FILE *file = fmemopen(mem, sizeof(mem), "r");
+    expect(file != NULL);
+    char line[100];
+    expect(line == fgets(line, sizeof(line), file));
+    expect(0 == strcmp(line, "hello"));
+    expect(EOF != fclose(file));
+
+    file = fmemopen(mem, sizeof(mem), "a");
+    expect(file != NULL);
+    expect(7 == fprintf(file, " world!"));
+    expect(0 == fflush(file));
+    expect(0 == strcmp(mem, "hello world!"));
+    // only 4 more bytes fit
+    fwrite("123456", 1, 6, file);
+    fflush(file);
+    expect(0 == memcmp(mem, "hello world!1234", 16));
+    expect(0 == fclose(file));
+
+    file = fmemopen(mem, sizeof(mem), "w+");
+    expect(file != NULL);
+    expect(mem[0] == 0);
+    expect(3 == fwrite("abc", 1, 3, file));
+    expect(0 == fflush(file));
+    expect(0 == strcmp(mem, "abc"));
+    rewind(file);
+    expect('a' == getc(file));
+    expect('b' == getc(file));
+    expect(0 == fclose(file));
+
+    char digits[10] = "012345678";
+    file = fmemopen(digits, sizeof(digits), "r+");
+    expect(file != NULL);
+    expect('0' == getc(file));
+    expect('1' == getc(file));
+    // pushback doesn't write to the memory
+    expect('x' == ungetc('x', file));
+    expect(digits[1] == '1');
+    expect('x' == getc(file));
+    expect(2 == ftell(file));
+    expect('2' == getc(file));
+    expect(0 == fseek(file, 0, SEEK_CUR));
+    expect('Z' == fputc('Z', file));
+    expect(0 == fflush(file));
+    expect(0 == memcmp(digits, "012Z45678", 10));
+    expect(0 == fseek(file, 0, SEEK_CUR));
+    expect('4' == getc(file));
+    expect(5 == ftell(file));
+    expect(0 == fseek(file, 7, SEEK_SET));
+    expect(3 == fread(line, 1, sizeof(line), file));
+    expect(0 == memcmp(line, "78", 3));
+    expect(feof(file));
+    expect(0 == fclose(file));
+
+    file = fmemopen(NULL, 10, "w+");
+    expect(file != NULL);
+    expect(5 == fprintf(file, "%d", 12345));
+    rewind(file);
+    expect(line == fgets(line, sizeof(line), file));
+    expect(0 == strcmp(line, "12345"));
+    expect(0 == fclose(file));
+  }
+
+  {
+    char *data = NULL;
+    size_t size = 1234;
+    FILE *file = open_memstream(&data, &size);
+    expect(file != NULL);
+    expect(0 == fflush(file));
+    expect(data != NULL && size == 0 && data[0] == 0);
+    for (int i = 0; i < 1000; i++) {
+      expect(0 < fprintf(file, "%d,", i));
+    }
+    expect(0 == fflush(file));
+    expect(size == strlen(data));
+    expect(0 == memcmp(data, "0,1,2,", 6));
+    expect(0 == memcmp(data + size - 4, "999,", 4));
+    // seeking past the end and writing leaves zeros
+    expect(0 == fseek(file, 2, SEEK_END));
+    expect('x' == fputc('x', file));
+    expect(0 == fclose(file));
+    expect(data[size - 3] == 0 && data[size - 2] == 0 && data[size - 1] == 'x' && data[size] == 0);
+    free(data);
+  }
+
+  {
+    // bigger than the buffer so seeks land inside and outside of it
+    FILE *file = fopen("seek.txt", "w");
+    expect(file != NULL);
+    expect(0 == ftell(file));
+    for (int i = 0; i < 20000; i++) {
+      expect(EOF != fputc('a' + i % 26, file));
+    }
+    expect(20000 == ftell(file));
+    expect(0 == fseek(file, 100, SEEK_SET));
+    expect(EOF != fputc('!', file));
+    expect(101 == ftell(file));
+    expect(0 == fclose(file));
+
+    file = fopen("seek.txt", "r");
+    expect(file != NULL);
+    expect('a' == getc(file));
+    expect('b' == getc(file));
+    expect(2 == ftell(file));
+    expect(0 == fseek(file, 50, SEEK_CUR));
+    expect(52 == ftell(file));
+    expect('a' + 52 % 26 == getc(file));
+    expect(0 == fseek(file, -3, SEEK_CUR));
+    expect('a' + 50 % 26 == getc(file));
+    expect(0 == fseek(file, 100, SEEK_SET));
+    expect('!' == getc(file));
+    expect(0 == fseek(file, 15000, SEEK_SET));
+    expect(15000 == ftell(file));
+    expect('a' + 15000 % 26 == getc(file));
+    expect(0 == fseek(file, -1, SEEK_END));
+    expect(19999 == ftell(file));
+    expect('a' + 19999 % 26 == getc(file));
+    expect(EOF == getc(file));
+    expect(feof(file));
+    expect(0 == fseek(file, 7, SEEK_SET));
+    expect(!feof(file));
+    expect(0 != fseek(file, -1, SEEK_SET));
+    expect(7 == ftell(file));
+
+    fpos_t pos;
+    expect(0 == fgetpos(file, &pos));
+    expect('a' + 7 % 26 == getc(file));
+    expect('h' == ungetc('h', file));
+    expect(7 == ftell(file));
+    expect('h' == getc(file));
+    expect(0 == fseek(file, 12345, SEEK_SET));
+    expect(0 == fsetpos(file, &pos));
+    expect(7 == ftell(file));
+    expect('a' + 7 % 26 == getc(file));
+
+    // a seek back to the start of the buffer leaves no room in front of the
+    // unread input, ungetc still gets its one byte
+    expect(0 == fseek(file, 1000, SEEK_SET));
+    expect('a' + 1000 % 26 == getc(file));
+    expect('a' + 1001 % 26 == getc(file));
+    expect(0 == fseek(file, -2, SEEK_CUR));
+    expect('Q' == ungetc('Q', file));
+    expect(999 == ftell(file));
+    expect('Q' == getc(file));
+    expect('a' + 1000 % 26 == getc(file));
+    expect(1001 == ftell(file));
+    expect(0 == fclose(file));
+  }
+
+  {
+    // reads bigger than the buffer go straight into the caller's memory
+    static char big[30000];
+    FILE *file = fopen("seek.txt", "r");
+    expect(file != NULL);
+    expect('a' == getc(file));
+    expect(15000 == fread(big, 1, 15000, file));
+    expect(big[0] == 'b' && big[14999] == 'a' + 15000 % 26);
+    expect(15001 == ftell(file));
+    expect(0 == fseek(file, 0, SEEK_SET));
+    expect(2000 == fread(big, 10, 3000, file));
+    expect(feof(file));
+    expect(big[100] == '!' && big[19999] == 'a' + 19999 % 26);
+    expect(0 == fclose(file));
+  }
+
+  {
+    // "m" reads from a mapping of the file
+    static char big[30000];
+    char line[100];
+    FILE *file = fopen("seek.txt", "rm");
+    expect(file != NULL);
+    expect('a' == getc(file));
+    expect('a' == ungetc('a', file));
+    expect('a' == getc(file));
+    expect('b' == getc(file));
+    expect('X' == ungetc('X', file));
+    expect(1 == ftell(file));
+    expect('X' == getc(file));
+    expect('c' == getc(file));
+    expect(0 == fseek(file, 100, SEEK_SET));
+    expect(line == fgets(line, 5, file));
+    expect(0 == strcmp(line, "!xyz"));
+    expect(104 == ftell(file));
+    expect(EOF == fputc('x', file));
+    expect(ferror(file));
+    clearerr(file);
+    expect(0 == fseek(file, 0, SEEK_SET));
+    expect(20000 == fread(big, 1, sizeof(big), file));
+    expect(feof(file));
+    expect(big[100] == '!' && big[19999] == 'a' + 19999 % 26);
+    expect(0 == fclose(file));
+  }
+
+  {
+    char line[100];
+    FILE *file = fopen("append.txt", "w");
+    expect(file != NULL);
+    expect(EOF != fputs("abc", file));
+    expect(0 == fclose(file));
+    file = fopen("append.txt", "ab");
+    expect(file != NULL);
+    expect(EOF != fputs("def", file));
+    expect(0 == fclose(file));
+    file = fopen("append.txt", "a+");
+    expect(file != NULL);
+    expect('a' == getc(file));
+    // writes still go to the end
+    expect(EOF != fputs("ghi", file));
+    expect(0 == fseek(file, 0, SEEK_SET));
+    expect(line == fgets(line, sizeof(line), file));
+    expect(0 == strcmp(line, "abcdefghi"));
+    expect(0 == fclose(file));
+
+    expect(NULL == fopen("append.txt", "wx"));
+    expect(errno == EEXIST);
+    unlink("append.txt");
+    file = fopen("append.txt", "wxe");
+    expect(file != NULL);
+    expect(0 == fclose(file));
+    errno = 0;
+    expect(NULL == fopen("append.txt", "z"));
+    expect(errno == EINVAL);
+  }
+
+  // an unbuffered puts writes the string and the newline together
+  expect(0 == setvbuf(stdout, NULL, _IONBF, 0));
+  expect(0 <= puts("Success!"));
+  return 0;
+}
@@ -1,9 +1,19 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "expect.h"
 
+static const char *naive_search(const char *hay, size_t hay_len, const char *needle, size_t needle_len)
+{
+  for (size_t i = 0; i + needle_len <= hay_len; i++) {
+    if (0 == memcmp(hay + i, needle, needle_len))
+      return hay + i;
+  }
+  return NULL;
+}
+
 int main(int argc, char *argv[])
 {
   expect(16 == strlen("this is a string"));
@@ -31,6 +41,295 @@ int main(int argc, char *argv[])
     expect(NULL == strstr(s, "bcdeg"));
   }
 
+  {
+    // every start and end alignment across a few vector blocks
+    static char buf[256];
+    for (int start = 0; start < 64; start++) {
+      for (int len = 0; start + len < 200; len++) {
+        memset(buf, 'a', sizeof(buf));
+        char *s = buf + start;
+        s[len] = 0;
+        expect(len == strlen(s));
+        expect(NULL == strchr(s, 'b'));
+        expect(s + len == strchr(s, 0));
+        expect(s + len == strrchr(s, 0));
+        expect(NULL == memchr(s, 'b', len));
+        if (len > 0) {
+          s[0] = 'b';
+          s[len - 1] = 'b';
+          expect(s == strchr(s, 'b'));
+          expect(s + len - 1 == strrchr(s, 'b'));
+          expect(s == memchr(s, 'b', len));
+          if (len > 1) {
+            expect(NULL == memchr(s + 1, 'b', len - 2));
+            expect(s + len - 1 == memchr(s + 1, 'b', len - 1));
+          }
+          // bytes past the end don't count
+          s[len + 1] = 'c';
+          expect(NULL == strchr(s, 'c'));
+          expect(NULL == strrchr(s, 'c'));
+        }
+      }
+    }
+    // chars are compared as unsigned char
+    expect(buf == memchr(buf, 'a' + 256, 10));
+    buf[5] = (char)0xff;
+    expect(buf + 5 == strchr(buf, 0xff));
+  }
+
+  {
+    // strcmp loads both strings in blocks, whatever their alignment
+    static char a[256], b[256];
+    for (int offset = 0; offset < 64; offset++) {
+      for (int len = 0; offset + len < 200; len += 7) {
+        memset(a, 'x', sizeof(a));
+        memset(b, 'x', sizeof(b));
+        char *sa = a + 3;
+        char *sb = b + offset;
+        sa[len] = 0;
+        sb[len] = 0;
+        expect(0 == strcmp(sa, sb));
+        sb[len] = 'y';
+        sb[len + 1] = 0;
+        expect(0 > strcmp(sa, sb));
+        expect(0 < strcmp(sb, sa));
+        if (len > 0) {
+          sb[len / 2] = (char)0x80;
+          // bytes compare as unsigned char
+          expect(0 > strcmp(sa, sb));
+        }
+      }
+    }
+  }
+
+  {
+    // memcpy and memset across sizes and alignments, the bytes around the
+    // destination stay untouched
+    static unsigned char src[4300], dst[4400];
+    for (size_t i = 0; i < sizeof(src); i++)
+      src[i] = (unsigned char)(i * 7 + 1);
+    for (int offset = 0; offset < 64; offset += 5) {
+      for (size_t len = 0; len < 4200; len = len < 160 ? len + 1 : len * 2 - 3) {
+        memset(dst, 0xee, sizeof(dst));
+        expect(dst + offset + 1 == memcpy(dst + offset + 1, src + offset / 3, len));
+        expect(0 == memcmp(dst + offset + 1, src + offset / 3, len));
+        expect(dst[offset] == 0xee);
+        expect(dst[offset + 1 + len] == 0xee);
+
+        memset(dst, 0xee, sizeof(dst));
+        expect(dst + offset == memset(dst + offset, 0x1ab, len));
+        for (size_t i = 0; i < len; i++)
+          expect(dst[offset + i] == 0xab);
+        expect(dst[offset + len] == 0xee);
+      }
+    }
+  }
+
+  {
+    // memmove with the memory overlapping either way
+    static unsigned char buf[5000], expected[5000];
+    for (size_t shift = 1; shift < 80; shift += 3) {
+      for (size_t len = 1; len < 4500; len = len < 140 ? len + 1 : len * 2 + 5) {
+        for (size_t i = 0; i < sizeof(buf); i++)
+          buf[i] = (unsigned char)(i * 13);
+        for (size_t i = 0; i < len; i++)
+          expected[i] = buf[100 + i];
+        memmove(buf + 100 + shift, buf + 100, len);
+        expect(0 == memcmp(buf + 100 + shift, expected, len));
+        memmove(buf + 100, buf + 100 + shift, len);
+        expect(0 == memcmp(buf + 100, expected, len));
+      }
+    }
+  }
+
+  {
+    // memcmp compares unsigned chars and stops at n
+    static unsigned char a[300], b[300];
+    for (int len = 0; len < 200; len++) {
+      for (int offset = 0; offset < 40; offset += 3) {
+        memset(a, 'x', sizeof(a));
+        memset(b, 'x', sizeof(b));
+        unsigned char *pa = a + 1;
+        unsigned char *pb = b + offset;
+        pb[len] = 'y';
+        expect(0 == memcmp(pa, pb, len));
+        if (len > 0) {
+          pb[len - 1] = 0x80;
+          expect(0 > memcmp(pa, pb, len));
+          expect(0 < memcmp(pb, pa, len));
+          pa[len / 2] = 0;
+          expect(0 > memcmp(pa, pb, len));
+        }
+      }
+    }
+    expect(0 == memcmp("a", "b", 0));
+  }
+
+  {
+    // short needles take the first and last byte filter, long ones Two-Way,
+    // repetitive text is the worst case for a naive search
+    static char hay[3000], needle[200];
+    unsigned seed = 1;
+    for (int round = 0; round < 3000; round++) {
+      int alphabet = 1 + round % 3;
+      size_t hay_len = round % 7 == 0 ? 2500 : (size_t)(round % 400);
+      for (size_t i = 0; i < hay_len; i++) {
+        seed = seed * 1103515245 + 12345;
+        hay[i] = 'a' + (seed >> 16) % alphabet;
+      }
+      hay[hay_len] = 0;
+      size_t needle_len = 1 + round % 90;
+      if (needle_len > hay_len)
+        needle_len = hay_len;
+      if (round % 2 && hay_len > 0) {
+        memcpy(needle, hay + (hay_len - needle_len) / 2, needle_len);
+      } else {
+        for (size_t i = 0; i < needle_len; i++) {
+          seed = seed * 1103515245 + 12345;
+          needle[i] = 'a' + (seed >> 16) % alphabet;
+        }
+      }
+      needle[needle_len] = 0;
+      const char *expected = naive_search(hay, hay_len, needle, needle_len);
+      expect(expected == strstr(hay, needle));
+      expect(expected == memmem(hay, hay_len, needle, needle_len));
+    }
+    expect(hay == strstr(hay, ""));
+    expect(hay == memmem(hay, 10, "", 0));
+    expect(NULL == memmem(hay, 0, "a", 1));
+    expect(NULL == strstr("abc", "abcd"));
+
+    // a long periodic needle that only matches at the very end
+    memset(hay, 'a', 2000);
+    hay[1999] = 'b';
+    hay[2000] = 0;
+    memset(needle, 'a', 100);
+    needle[99] = 'b';
+    needle[100] = 0;
+    expect(hay + 1900 == strstr(hay, needle));
+    needle[50] = 'b';
+    expect(NULL == strstr(hay, needle));
+  }
+
+  {
+    const char *s = "The Quick brown FOX jumps over the lazy dog";
+    expect(s + 4 == strcasestr(s, "quick"));
+    expect(s + 16 == strcasestr(s, "fox"));
+    expect(s + 16 == strcasestr(s, "Fox Jumps Over The Lazy Dog"));
+    expect(s + 31 == strcasestr(s, "THE LAZY"));
+    expect(NULL == strcasestr(s, "foxes"));
+    expect(s == strcasestr(s, ""));
+    // only ASCII letters fold, '@' and '`' are 0x20 apart too
+    expect(NULL == strcasestr("a@b", "A`B"));
+    expect(s + 10 == strcasestr(s, "BROWN fox JUMPS OVER THE LAZY DOG"));
+  }
+
+  {
+    // memrchr and rawmemchr across alignments
+    static char buf[300];
+    for (int offset = 0; offset < 64; offset++) {
+      for (int len = 0; offset + len < 200; len += 3) {
+        memset(buf, 'x', sizeof(buf));
+        char *s = buf + offset;
+        s[len] = 'a';
+        expect(NULL == memrchr(s, 'a', len));
+        expect(s + len == rawmemchr(s, 'a'));
+        if (len > 0) {
+          s[0] = 'a';
+          expect(s == memrchr(s, 'a', len));
+          expect(s == rawmemchr(s, 'a'));
+          s[len / 2] = 'a';
+          expect(s + len / 2 == memrchr(s, 'a', len));
+          s[len - 1] = 'a';
+          expect(s + len - 1 == memrchr(s, 'a', len));
+        }
+        if (offset > 0) {
+          s[-1] = 'y';
+          expect(NULL == memrchr(s, 'y', len));
+        }
+      }
+    }
+  }
+
+  {
+    // small sets take the vector kernels, large ones the 256-bit table
+    static const char *sets[] = { "", "a", "ab", "abc,;", " \t\n\r\v\f,;", "abcdefghijklmnopqrstuvwxyz", "\x80\xff\x01 z" };
+    static char buf[300];
+    for (int set_index = 0; set_index < (int)(sizeof(sets) / sizeof(sets[0])); set_index++) {
+      const char *set = sets[set_index];
+      for (int offset = 0; offset < 40; offset += 3) {
+        for (int len = 0; offset + len < 200; len += 5) {
+          char *s = buf + offset;
+          for (int i = 0; i < len; i++)
+            s[i] = set[0] ? set[i % strlen(set)] : 'x';
+          s[len] = 0;
+          size_t expected = set[0] ? (size_t)len : 0;
+          expect(expected == strspn(s, set));
+          if (set[0] && len > 0) {
+            s[len / 2] = 'A';
+            expect((size_t)len / 2 == strspn(s, set));
+            expect(0 == strcspn(s, set));
+            expect(s == strpbrk(s, set));
+            // a span of bytes that aren't in the set up to one that is
+            memset(s, 'A', len / 2 + 1);
+            expect((size_t)len / 2 + 1 == strcspn(s, set));
+            expect((len / 2 + 1 < len ? s + len / 2 + 1 : NULL) == strpbrk(s, set));
+          }
+          memset(s, 'A', len);
+          expect((size_t)len == strcspn(s, set));
+          expect(NULL == strpbrk(s, set));
+        }
+      }
+    }
+  }
+
+  {
+    char line[] = ",,name, value;;other,";
+    expect(0 == strcmp("name", strtok(line, ",; ")));
+    expect(0 == strcmp("value", strtok(NULL, ",; ")));
+    expect(0 == strcmp("other", strtok(NULL, ",; ")));
+    expect(NULL == strtok(NULL, ",; "));
+    expect(NULL == strtok(NULL, ",; "));
+  }
+
+  {
+    // two strtok_r loops interleaved, each keeps its own place
+    char a[] = "a1 a2\ta3";
+    char b[] = "b1,b2,,b3,";
+    char *save_a, *save_b;
+    char *ta = strtok_r(a, " \t", &save_a);
+    char *tb = strtok_r(b, ",", &save_b);
+    expect(0 == strcmp("a1", ta));
+    expect(0 == strcmp("b1", tb));
+    expect(0 == strcmp("a2", strtok_r(NULL, " \t", &save_a)));
+    expect(0 == strcmp("b2", strtok_r(NULL, ",", &save_b)));
+    expect(0 == strcmp("b3", strtok_r(NULL, ",", &save_b)));
+    expect(0 == strcmp("a3", strtok_r(NULL, " \t", &save_a)));
+    expect(NULL == strtok_r(NULL, " \t", &save_a));
+    expect(NULL == strtok_r(NULL, ",", &save_b));
+
+    // a delimiter set too large for the vector kernels
+    char c[] = "key=value#comment";
+    char *save_c;
+    const char *delims = "=#!$%&*+-/:<>?@";
+    expect(0 == strcmp("key", strtok_r(c, delims, &save_c)));
+    expect(0 == strcmp("value", strtok_r(NULL, delims, &save_c)));
+    expect(0 == strcmp("comment", strtok_r(NULL, delims, &save_c)));
+    expect(NULL == strtok_r(NULL, delims, &save_c));
+  }
+
+  {
+    // strsep keeps the empty fields between delimiters
+    char csv[] = "a,,b;c";
+    char *next = csv;
+    expect(0 == strcmp("a", strsep(&next, ",;")));
+    expect(0 == strcmp("", strsep(&next, ",;")));
+    expect(0 == strcmp("b", strsep(&next, ",;")));
+    expect(0 == strcmp("c", strsep(&next, ",;")));
+    expect(NULL == next);
+    expect(NULL == strsep(&next, ",;"));
+  }
+
   puts("Success!");
   return 0;
 }
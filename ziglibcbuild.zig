@@ -14,11 +14,20 @@ pub const Start = enum {
     ziglibc,
     glibc,
 };
+pub const Malloc = enum {
+    /// GeneralPurposeAllocator, slow but catches double frees and leaks
+    debug,
+    /// size-class allocator
+    fast,
+    /// bump allocator that never gives memory back, for short-lived programs
+    bump,
+};
 pub const ZigLibcOptions = struct {
     variant: LibVariant,
     link: LinkKind,
     start: Start,
     trace: bool,
+    malloc: Malloc,
     target: std.zig.CrossTarget,
     optimize: std.builtin.Mode,
 };
@@ -61,6 +70,8 @@ pub fn addLibc(builder: *std.build.Builder, opt: ZigLibcOptions) *CompileStep {
     };
     const trace_options = builder.addOptions();
     trace_options.addOption(bool, "enabled", opt.trace);
+    const malloc_options = builder.addOptions();
+    malloc_options.addOption(Malloc, "backend", opt.malloc);
 
     const modules_options = builder.addOptions();
     modules_options.addOption(bool, "glibcstart", switch (opt.start) {
@@ -91,6 +102,7 @@ pub fn addLibc(builder: *std.build.Builder, opt: ZigLibcOptions) *CompileStep {
     lib.force_pic = true;
     lib.addOptions("modules", modules_options);
     lib.addOptions("trace_options", trace_options);
+    lib.addOptions("malloc_options", malloc_options);
     const c_flags = [_][]const u8{
         "-std=c11",
     };
@@ -106,6 +118,15 @@ pub fn addLibc(builder: *std.build.Builder, opt: ZigLibcOptions) *CompileStep {
             lib.addAssemblyFile(relpath("src/linux/jmp.s"));
         }
     }
+    const simd_options = builder.addOptions();
+    const with_simd_variants = include_cstd and opt.target.getCpuArch() == .x86_64;
+    simd_options.addOption(bool, "variants", with_simd_variants);
+    lib.addOptions("simd_options", simd_options);
+    if (with_simd_variants) {
+        for (simd_variants) |variant| {
+            addSimdVariant(builder, lib, opt, simd_options, variant);
+        }
+    }
     const include_posix = switch (opt.variant) {
         .only_posix, .full => true,
         else => false,
@@ -133,3 +154,39 @@ pub fn addLibc(builder: *std.build.Builder, opt: ZigLibcOptions) *CompileStep {
     }
     return lib;
 }
+
+/// The kernels in src/simd.zig built again for wider x86 vectors, the
+/// library picks one at startup
+const SimdVariant = struct {
+    name: []const u8,
+    vec_len: usize,
+    features: []const std.Target.x86.Feature,
+};
+const simd_variants = [_]SimdVariant{
+    .{ .name = "avx2", .vec_len = 32, .features = &.{ .avx2, .bmi, .bmi2 } },
+    .{ .name = "avx512", .vec_len = 64, .features = &.{ .avx512bw, .bmi, .bmi2 } },
+};
+
+fn addSimdVariant(
+    builder: *std.Build,
+    lib: *CompileStep,
+    opt: ZigLibcOptions,
+    simd_options: *std.Build.Step.Options,
+    variant: SimdVariant,
+) void {
+    var target = opt.target;
+    target.cpu_features_add.addFeatureSet(std.Target.x86.featureSet(variant.features));
+    const variant_options = builder.addOptions();
+    variant_options.addOption([]const u8, "name", variant.name);
+    variant_options.addOption(usize, "vec_len", variant.vec_len);
+    const obj = builder.addObject(.{
+        .name = builder.fmt("simd-{s}", .{variant.name}),
+        .root_source_file = relpath("src" ++ std.fs.path.sep_str ++ "simd_variant.zig"),
+        .target = target,
+        .optimize = opt.optimize,
+    });
+    obj.force_pic = true;
+    obj.addOptions("simd_variant", variant_options);
+    obj.addOptions("simd_options", simd_options);
+    lib.addObject(obj);
+}